@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "BatteryHistory.h"
+
+#include <android-base/logging.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+
+namespace aidl::android::hardware::health::gs201 {
+
+using ::android::base::boot_clock;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr auto kMinSampleInterval = 10s;
+// Sample interval at or below kCriticalLevel, where every sample is flushed.
+constexpr auto kCriticalSampleInterval = 5s;
+constexpr auto kWritebackInterval = 60s;
+// Retry interval while /data/vendor is not available yet.
+constexpr auto kReopenInterval = 60s;
+// At or below this level samples are taken more often and flushed immediately.
+constexpr int kCriticalLevel = 5;
+
+constexpr size_t kRecordsPerPage = kBatteryHistoryPageSize / sizeof(BatteryHistoryRecord);
+
+int64_t ToMs(std::chrono::nanoseconds ns) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(ns).count();
+}
+
+}  // namespace
+
+BatteryHistory::BatteryHistory(std::string path, const std::string &fg_dir)
+    : path_(std::move(path)),
+      resistance_node_(fg_dir + "/resistance"),
+      ocv_node_(fg_dir + "/voltage_ocv"),
+      voltage_node_(fg_dir + "/voltage_now") {}
+
+BatteryHistory::~BatteryHistory() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (map_ == nullptr) return;
+  if (dirty_page_) SyncLocked();
+  munmap(map_, kBatteryHistoryFileSize);
+}
+
+bool BatteryHistory::OpenLocked() {
+  fd_.reset(open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0640));
+  if (fd_ == -1) {
+    PLOG(WARNING) << "Unable to open " << path_;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd_, &st) == -1) {
+    PLOG(ERROR) << "fstat " << path_;
+    fd_.reset();
+    return false;
+  }
+  if (static_cast<size_t>(st.st_size) != kBatteryHistoryFileSize) {
+    // Allocate every block up front so that writeback never has to allocate.
+    int ret = ftruncate(fd_, 0);
+    if (ret == 0) ret = posix_fallocate(fd_, 0, kBatteryHistoryFileSize);
+    if (ret != 0) {
+      LOG(ERROR) << "Unable to allocate " << path_;
+      fd_.reset();
+      return false;
+    }
+  }
+
+  void *map = mmap(nullptr, kBatteryHistoryFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED) {
+    PLOG(ERROR) << "mmap " << path_;
+    fd_.reset();
+    return false;
+  }
+  map_ = static_cast<uint8_t *>(map);
+  header_ = reinterpret_cast<BatteryHistoryHeader *>(map_);
+  records_ = reinterpret_cast<BatteryHistoryRecord *>(map_ + kBatteryHistoryPageSize);
+
+  if (header_->magic != kBatteryHistoryMagic || header_->version != kBatteryHistoryVersion ||
+      header_->record_size != sizeof(BatteryHistoryRecord) ||
+      header_->record_count != kBatteryHistoryRecordCount ||
+      header_->crc != BatteryHistoryChecksum(*header_)) {
+    LOG(INFO) << "Initializing battery history " << path_;
+    memset(map_, 0, kBatteryHistoryFileSize);
+    header_->magic = kBatteryHistoryMagic;
+    header_->version = kBatteryHistoryVersion;
+    header_->record_size = sizeof(BatteryHistoryRecord);
+    header_->record_count = kBatteryHistoryRecordCount;
+  }
+  header_->boot_count++;
+  header_->crc = BatteryHistoryChecksum(*header_);
+  SyncLocked();
+
+  RecoverLocked();
+  return true;
+}
+
+void BatteryHistory::RecoverLocked() {
+  std::optional<size_t> newest;
+  for (size_t slot = 0; slot < kBatteryHistoryRecordCount; slot++) {
+    const BatteryHistoryRecord &record = records_[slot];
+    if (record.magic != kBatteryHistoryRecordMagic ||
+        record.crc != BatteryHistoryChecksum(record))
+      continue;
+    recovered_++;
+    if (!newest || record.seq > records_[*newest].seq) newest = slot;
+  }
+
+  if (newest) {
+    next_seq_ = records_[*newest].seq + 1;
+    next_slot_ = (*newest + 1) % kBatteryHistoryRecordCount;
+  }
+  LOG(INFO) << "Battery history: boot " << header_->boot_count << ", recovered " << recovered_
+            << " records, next seq " << next_seq_;
+}
+
+void BatteryHistory::WritebackLocked(size_t page) {
+  if (sync_file_range(fd_, page * kBatteryHistoryPageSize, kBatteryHistoryPageSize,
+                      SYNC_FILE_RANGE_WRITE) == -1)
+    PLOG(WARNING) << "sync_file_range " << path_;
+  last_writeback_ = boot_clock::now();
+  writebacks_++;
+}
+
+void BatteryHistory::FlushLocked(size_t page) {
+  if (sync_file_range(fd_, page * kBatteryHistoryPageSize, kBatteryHistoryPageSize,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+    PLOG(WARNING) << "sync_file_range " << path_;
+  last_writeback_ = boot_clock::now();
+  flushes_++;
+}
+
+void BatteryHistory::SyncLocked() {
+  // sync_file_range() does not flush the metadata f2fs needs to find the blocks again
+  // after a power loss, even though they are preallocated.
+  if (fdatasync(fd_) == -1) PLOG(WARNING) << "fdatasync " << path_;
+  last_writeback_ = boot_clock::now();
+  syncs_++;
+}
+
+void BatteryHistory::Record(const HealthInfo &health_info) {
+  auto now = boot_clock::now();
+  bool critical = health_info.batteryLevel <= kCriticalLevel;
+  auto interval = critical ? kCriticalSampleInterval : kMinSampleInterval;
+  if (last_sample_ && now - *last_sample_ < interval) return;
+
+  std::lock_guard<std::mutex> lock(lock_);
+  if (map_ == nullptr) {
+    if (last_open_attempt_ && now - *last_open_attempt_ < kReopenInterval) return;
+    last_open_attempt_ = now;
+    if (!OpenLocked()) return;
+  }
+  last_sample_ = now;
+
+  BatteryHistoryRecord record = {};
+  record.magic = kBatteryHistoryRecordMagic;
+  record.seq = next_seq_++;
+  record.boot_count = header_->boot_count;
+  record.status = static_cast<int32_t>(health_info.batteryStatus);
+  record.boot_time_ms = ToMs(now.time_since_epoch());
+  record.real_time_ms = ToMs(std::chrono::system_clock::now().time_since_epoch());
+  record.level = health_info.batteryLevel;
+  record.current_ua = health_info.batteryCurrentMicroamps;
+  record.temperature_decic = health_info.batteryTemperatureTenthsCelsius;
+  voltage_node_.ReadInt(&record.voltage_uv);
+  ocv_node_.ReadInt(&record.ocv_uv);
+  resistance_node_.ReadInt(&record.resistance);
+  record.crc = BatteryHistoryChecksum(record);
+
+  size_t slot = next_slot_;
+  records_[slot] = record;
+  next_slot_ = (slot + 1) % kBatteryHistoryRecordCount;
+  records_written_++;
+
+  size_t page = 1 + slot / kRecordsPerPage;
+  if (dirty_page_ && *dirty_page_ != page) WritebackLocked(*dirty_page_);
+  dirty_page_ = page;
+  // The full sync waits for a checkpoint on f2fs, too slow for the health loop every
+  // kCriticalSampleInterval. Until the next one, a power loss may lose the flushed
+  // records of the current page, but not the pages synced before it.
+  if (slot % kRecordsPerPage == kRecordsPerPage - 1 || health_info.batteryLevel == 0) {
+    SyncLocked();
+    dirty_page_.reset();
+  } else if (critical) {
+    FlushLocked(page);
+  } else if (now - last_writeback_ >= kWritebackInterval) {
+    WritebackLocked(page);
+    dirty_page_.reset();
+  }
+}
+
+void BatteryHistory::Dump(int fd) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (map_ == nullptr) {
+    dprintf(fd, "Battery history: %s not open\n", path_.c_str());
+    return;
+  }
+  dprintf(fd,
+          "Battery history: %s boot %u, %zu recovered, %" PRIu64 " written, %" PRIu64
+          " writebacks, %" PRIu64 " flushes, %" PRIu64 " syncs, next seq %" PRIu64 "\n",
+          path_.c_str(), header_->boot_count, recovered_, records_written_, writebacks_,
+          flushes_, syncs_, next_seq_);
+}
+
+}  // namespace aidl::android::hardware::health::gs201
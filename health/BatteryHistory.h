@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/health/HealthInfo.h>
+#include <android-base/chrono_utils.h>
+#include <android-base/unique_fd.h>
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "BatteryHistoryFormat.h"
+#include "SysfsReader.h"
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Appends fuel gauge samples to a memory-mapped ring file so that the minutes before a
+// brownout or reboot survive it. Samples are stored through the mapping. Writeback of
+// the current page is started once kWritebackInterval has passed. At a critically low
+// level, sampled once per kCriticalSampleInterval, each sample's page is written out
+// and waited for. The file is only fdatasync'ed when a page fills, when the level
+// reaches 0 and the framework is about to shut down, and on destruction.
+class BatteryHistory {
+ public:
+  BatteryHistory(std::string path, const std::string &fg_dir);
+  ~BatteryHistory();
+
+  // Samples the fuel gauge and appends a record. Called from the health update path;
+  // rate limited to one record per kMinSampleInterval, or per kCriticalSampleInterval
+  // at critically low levels.
+  void Record(const HealthInfo &health_info);
+  // Called from binder threads.
+  void Dump(int fd);
+
+ private:
+  bool OpenLocked();
+  // Scans the ring for the newest valid record to continue after it.
+  void RecoverLocked();
+  // Starts writeback of |page| without waiting for it.
+  void WritebackLocked(size_t page);
+  // Writes |page| and waits for it, without the metadata flush of SyncLocked().
+  void FlushLocked(size_t page);
+  // Writes back every dirty page and waits for it.
+  void SyncLocked();
+
+  const std::string path_;
+  std::mutex lock_;
+  SysfsNode resistance_node_;
+  SysfsNode ocv_node_;
+  SysfsNode voltage_node_;
+
+  ::android::base::unique_fd fd_;
+  uint8_t *map_ = nullptr;
+  BatteryHistoryHeader *header_ = nullptr;
+  BatteryHistoryRecord *records_ = nullptr;
+
+  uint64_t next_seq_ = 0;
+  size_t next_slot_ = 0;
+  // Page holding records not yet synced or handed to writeback.
+  std::optional<size_t> dirty_page_;
+  std::optional<::android::base::boot_clock::time_point> last_sample_;
+  std::optional<::android::base::boot_clock::time_point> last_open_attempt_;
+  ::android::base::boot_clock::time_point last_writeback_;
+
+  size_t recovered_ = 0;
+  uint64_t records_written_ = 0;
+  uint64_t writebacks_ = 0;
+  uint64_t flushes_ = 0;
+  uint64_t syncs_ = 0;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
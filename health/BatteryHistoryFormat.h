@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// On-disk layout of the battery history ring, shared by the health HAL and the host
+// decoder. All fields are little endian.
+//
+// The file is one header page followed by kBatteryHistoryRecordPages pages of fixed
+// size records. Records never straddle a page. Each record carries a sequence number
+// that increases across reboots and a CRC over the rest of the record, so a record
+// torn by a power loss is detected and dropped, and the ring order is recovered by
+// sorting on the sequence number.
+namespace aidl::android::hardware::health::gs201 {
+
+constexpr uint32_t kBatteryHistoryMagic = 0x48544142;  // "BATH"
+constexpr uint32_t kBatteryHistoryRecordMagic = 0x52544142;  // "BATR"
+constexpr uint32_t kBatteryHistoryVersion = 1;
+constexpr size_t kBatteryHistoryPageSize = 4096;
+constexpr size_t kBatteryHistoryRecordPages = 32;
+
+struct BatteryHistoryHeader {
+  uint32_t crc;  // CRC32 of the bytes following this field
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t record_count;
+  // Incremented each time the health HAL opens the file.
+  uint32_t boot_count;
+};
+
+struct BatteryHistoryRecord {
+  uint32_t crc;  // CRC32 of the bytes following this field
+  uint32_t magic;
+  uint64_t seq;
+  uint32_t boot_count;
+  int32_t status;  // aidl BatteryStatus
+  int64_t boot_time_ms;
+  int64_t real_time_ms;
+  int32_t level;
+  int32_t current_ua;
+  int32_t voltage_uv;
+  int32_t ocv_uv;
+  int32_t resistance;  // as reported by the fuel gauge
+  int32_t temperature_decic;
+};
+
+static_assert(sizeof(BatteryHistoryRecord) == 64);
+static_assert(kBatteryHistoryPageSize % sizeof(BatteryHistoryRecord) == 0);
+
+constexpr size_t kBatteryHistoryRecordCount =
+    kBatteryHistoryRecordPages * kBatteryHistoryPageSize / sizeof(BatteryHistoryRecord);
+constexpr size_t kBatteryHistoryFileSize =
+    kBatteryHistoryPageSize * (1 + kBatteryHistoryRecordPages);
+
+// CRC-32 (IEEE 802.3), bitwise; records are small and written at most every few seconds.
+inline uint32_t BatteryHistoryCrc32(const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= p[i];
+    for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+template <typename T>
+uint32_t BatteryHistoryChecksum(const T &entry) {
+  return BatteryHistoryCrc32(reinterpret_cast<const uint8_t *>(&entry) + sizeof(entry.crc),
+                             sizeof(T) - sizeof(entry.crc));
+}
+
+}  // namespace aidl::android::hardware::health::gs201
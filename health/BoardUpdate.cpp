@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "BoardUpdate.h"
+
+#include <android-base/logging.h>
+
+namespace aidl::android::hardware::health::gs201 {
+
+BoardUpdate::BoardUpdate(std::string history_path, const std::string &fg_dir,
+                         std::string wlc_capacity_path, HealthUpdateStats *stats)
+    : battery_history_(std::move(history_path), fg_dir),
+      wlc_capacity_(std::move(wlc_capacity_path)),
+      stats_(stats) {}
+
+void BoardUpdate::Update(const HealthInfo &health_info, bool record_history) {
+  // The wireless charger driver resets its state when a pad is attached; resync then.
+  if (health_info.chargerWirelessOnline != wlc_online_) {
+    wlc_online_ = health_info.chargerWirelessOnline;
+    wlc_capacity_.Invalidate();
+  }
+
+  int batt_level = health_info.batteryStatus == BatteryStatus::FULL ? 101
+                                                                     : health_info.batteryLevel;
+  if (record_history) battery_history_.Record(health_info);
+
+  if (wlc_updates_) {
+    HealthUpdateStats::ScopedStage stage(stats_, HealthUpdateStats::kWlcCapacity);
+    if (!wlc_capacity_.Write(std::to_string(batt_level)))
+      LOG(INFO) << "Unable to write battery level to wireless capacity";
+  }
+}
+
+void BoardUpdate::Dump(int fd) {
+  wlc_capacity_.Dump(fd);
+  battery_history_.Dump(fd);
+}
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/health/HealthInfo.h>
+
+#include <string>
+
+#include "BatteryHistory.h"
+#include "HealthUpdateStats.h"
+#include "SysfsWriteCache.h"
+
+namespace aidl::android::hardware::health::gs201 {
+
+// The gs201 steps of the battery update that do not depend on libpixelhealth: appending
+// the battery history record and keeping the wireless charger capacity in step with the
+// battery level. It builds for the host as well, so health_replay runs the same code as
+// the service.
+class BoardUpdate {
+ public:
+  BoardUpdate(std::string history_path, const std::string &fg_dir,
+              std::string wlc_capacity_path, HealthUpdateStats *stats);
+
+  // Enables the wireless charger capacity writes, for devices that have the node.
+  void set_wlc_updates(bool enabled) { wlc_updates_ = enabled; }
+
+  // Runs after the pixel health components have shaped |health_info|. The history is
+  // only recorded if |record_history|; /data is not mounted in charger mode.
+  void Update(const HealthInfo &health_info, bool record_history);
+  void Dump(int fd);
+
+ private:
+  BatteryHistory battery_history_;
+  CachedSysfsFile wlc_capacity_;
+  HealthUpdateStats *const stats_;
+  bool wlc_updates_ = false;
+  bool wlc_online_ = false;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+
+#include "CoalescingHealthLoop.h"
+
+#include <android-base/logging.h>
+
+namespace aidl::android::hardware::health::gs201 {
+
+CoalescingHealthLoop::CoalescingHealthLoop(std::shared_ptr<IHealth> service,
+                                           std::shared_ptr<HalHealthLoopCallback> callback,
+                                           HealthLoopTuner *tuner, InitFunction on_init)
+    : service_(std::move(service)),
+      callback_(std::move(callback)),
+      tuner_(tuner),
+      on_init_(std::move(on_init)) {}
+
+void CoalescingHealthLoop::Init(healthd_config *config) {
+  on_init_(this, config);
+  tuner_->Attach(this, config, [this]() { RunBatteryUpdate(); });
+}
+
+void CoalescingHealthLoop::Heartbeat() {
+  callback_->OnHeartbeat();
+}
+
+int CoalescingHealthLoop::PrepareToWait() {
+  return callback_->OnPrepareToWait();
+}
+
+void CoalescingHealthLoop::ScheduleBatteryUpdate() {
+  if (tuner_->ShouldDefer()) return;
+  RunBatteryUpdate();
+}
+
+void CoalescingHealthLoop::RunBatteryUpdate() {
+  // As in HalHealthLoop: update() notifies the callbacks and may fail if the
+  // implementation cannot handle them; the loop reads the result back either way.
+  if (auto res = service_->update(); !res.isOk()) {
+    LOG(WARNING) << "update() on the health HAL implementation failed with "
+                 << res.getDescription();
+  }
+
+  HealthInfo health_info;
+  auto res = service_->getHealthInfo(&health_info);
+  CHECK(res.isOk()) << "getHealthInfo() on the health HAL implementation failed with "
+                    << res.getDescription();
+
+  tuner_->OnHealthInfoChanged(health_info);
+  bool charger_online = health_info.chargerAcOnline || health_info.chargerUsbOnline ||
+                        health_info.chargerWirelessOnline || health_info.chargerDockOnline;
+  AdjustWakealarmPeriods(charger_online);
+}
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/health/IHealth.h>
+#include <health-impl/HalHealthLoop.h>
+#include <health/HealthLoop.h>
+#include <healthd/healthd.h>
+
+#include <functional>
+#include <memory>
+
+#include "HealthLoopTuner.h"
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Runs the health HAL like the stock HalHealthLoop, but the battery updates that
+// uevents and periodic chores schedule go through a HealthLoopTuner first, so a burst
+// is coalesced before anything reads the battery or notifies a callback. The trailing
+// update of a burst runs the same path, including the wake alarm adjustment.
+//
+// HalHealthLoop is final and runs update(), getHealthInfo() and the wake alarm
+// adjustment for every scheduled update, so it cannot coalesce them itself.
+class CoalescingHealthLoop final : public ::android::hardware::health::HealthLoop {
+ public:
+  // |on_init| takes the place of HalHealthLoopCallback::OnInit, which requires a
+  // HalHealthLoop: it fills in |config| and registers its events with the loop.
+  using InitFunction =
+      std::function<void(::android::hardware::health::HealthLoop *loop, healthd_config *config)>;
+
+  CoalescingHealthLoop(std::shared_ptr<IHealth> service,
+                       std::shared_ptr<HalHealthLoopCallback> callback, HealthLoopTuner *tuner,
+                       InitFunction on_init);
+
+ private:
+  void Init(healthd_config *config) override;
+  void Heartbeat() override;
+  int PrepareToWait() override;
+  void ScheduleBatteryUpdate() override;
+  void RunBatteryUpdate();
+
+  std::shared_ptr<IHealth> service_;
+  std::shared_ptr<HalHealthLoopCallback> callback_;
+  HealthLoopTuner *tuner_;
+  InitFunction on_init_;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
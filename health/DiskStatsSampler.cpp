@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "DiskStatsSampler.h"
+
+#include <android-base/logging.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <vector>
+
+namespace aidl::android::hardware::health::gs201 {
+
+namespace {
+
+using namespace std::chrono_literals;
+
+// Indexes into /sys/block/<dev>/stat.
+enum StatField {
+  kReads = 0,
+  kReadMerges,
+  kReadSectors,
+  kReadTicks,
+  kWrites,
+  kWriteMerges,
+  kWriteSectors,
+  kWriteTicks,
+  kInFlight,
+  kIoTicks,
+  kTimeInQueue,
+};
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t rank = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+  return values[std::min(rank, values.size() - 1)];
+}
+
+}  // namespace
+
+DiskStatsSampler::DiskStatsSampler(std::string stat_path) : node_(std::move(stat_path)) {}
+
+void DiskStatsSampler::Tick() {
+  Snapshot snapshot = {};
+  if (node_.ReadInts(snapshot.fields, kStatFields) != kStatFields) return;
+  snapshot.time = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lock(lock_);
+  ring_[next_] = snapshot;
+  next_ = (next_ + 1) % kRingSize;
+  count_ = std::min(count_ + 1, kRingSize);
+}
+
+const DiskStatsSampler::Snapshot &DiskStatsSampler::SnapshotAt(size_t age) const {
+  return ring_[(next_ + kRingSize - 1 - age) % kRingSize];
+}
+
+bool DiskStatsSampler::Latest(DiskStats *stats) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (count_ == 0) return false;
+  const Snapshot &latest = SnapshotAt(0);
+
+  stats->reads = latest.fields[kReads];
+  stats->readMerges = latest.fields[kReadMerges];
+  stats->readSectors = latest.fields[kReadSectors];
+  stats->readTicks = latest.fields[kReadTicks];
+  stats->writes = latest.fields[kWrites];
+  stats->writeMerges = latest.fields[kWriteMerges];
+  stats->writeSectors = latest.fields[kWriteSectors];
+  stats->writeTicks = latest.fields[kWriteTicks];
+  stats->ioInFlight = latest.fields[kInFlight];
+  stats->ioTicks = latest.fields[kIoTicks];
+  stats->ioInQueue = latest.fields[kTimeInQueue];
+  return true;
+}
+
+DiskStatsSampler::Rates DiskStatsSampler::ComputeRates(const Snapshot &from, const Snapshot &to) {
+  Rates rates = {};
+  double elapsed_ms =
+      std::chrono::duration<double, std::milli>(to.time - from.time).count();
+  if (elapsed_ms <= 0) return rates;
+
+  auto delta = [&](StatField field) {
+    // Counters only go backwards if the device was reset; treat that as idle.
+    return to.fields[field] >= from.fields[field] ? to.fields[field] - from.fields[field] : 0;
+  };
+
+  uint64_t ios = delta(kReads) + delta(kWrites);
+  uint64_t sectors = delta(kReadSectors) + delta(kWriteSectors);
+
+  rates.iops = ios * 1000.0 / elapsed_ms;
+  rates.mbps = sectors * 512.0 / 1000.0 / elapsed_ms;
+  if (ios > 0) {
+    rates.latency_ms = static_cast<double>(delta(kReadTicks) + delta(kWriteTicks)) / ios;
+    rates.service_ms = static_cast<double>(delta(kIoTicks)) / ios;
+  }
+  rates.depth = delta(kTimeInQueue) / elapsed_ms;
+  return rates;
+}
+
+void DiskStatsSampler::DumpWindow(int fd, const char *name,
+                                  std::chrono::steady_clock::duration window) {
+  // Intervals between the samples that fall inside the window; ticks run a little late,
+  // so allow half an interval of slack.
+  auto limit = window + std::chrono::milliseconds(kSampleInterval) / 2;
+  size_t intervals = 0;
+  while (intervals + 1 < count_ && SnapshotAt(0).time - SnapshotAt(intervals + 1).time <= limit)
+    intervals++;
+  if (intervals == 0) return;
+
+  const Snapshot &from = SnapshotAt(intervals);
+  Rates total = ComputeRates(from, SnapshotAt(0));
+  double seconds = std::chrono::duration<double>(SnapshotAt(0).time - from.time).count();
+  dprintf(fd, "  %-4s over %.0fs: iops=%.1f MB/s=%.2f latency=%.2fms service=%.2fms depth=%.2f\n",
+          name, seconds, total.iops, total.mbps, total.latency_ms, total.service_ms, total.depth);
+  if (intervals < 2) return;
+
+  // Percentiles across the intervals between consecutive samples of the window.
+  std::vector<double> iops, mbps, latency, depth;
+  for (size_t age = 0; age < intervals; age++) {
+    Rates rates = ComputeRates(SnapshotAt(age + 1), SnapshotAt(age));
+    iops.push_back(rates.iops);
+    mbps.push_back(rates.mbps);
+    latency.push_back(rates.latency_ms);
+    depth.push_back(rates.depth);
+  }
+  for (const auto &[metric, values] :
+       {std::make_pair("iops", &iops), std::make_pair("MB/s", &mbps),
+        std::make_pair("latency_ms", &latency), std::make_pair("depth", &depth)}) {
+    dprintf(fd, "       %-10s p50=%.2f p90=%.2f p99=%.2f\n", metric, Percentile(*values, 0.5),
+            Percentile(*values, 0.9), Percentile(*values, 0.99));
+  }
+}
+
+void DiskStatsSampler::Dump(int fd) {
+  std::lock_guard<std::mutex> lock(lock_);
+
+  dprintf(fd, "Disk stats %s:\n", node_.path().c_str());
+  if (count_ == 0) {
+    dprintf(fd, "  no samples (error %d)\n", node_.error());
+    return;
+  }
+
+  const Snapshot &latest = SnapshotAt(0);
+  double age = std::chrono::duration<double>(std::chrono::steady_clock::now() - latest.time)
+                       .count();
+  dprintf(fd, "  counters %.0fs ago:", age);
+  for (size_t i = 0; i < kStatFields; i++) dprintf(fd, " %" PRIu64, latest.fields[i]);
+  dprintf(fd, "\n");
+
+  DumpWindow(fd, "1s", 1s);
+  DumpWindow(fd, "10s", 10s);
+  DumpWindow(fd, "60s", 60s);
+}
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/health/DiskStats.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "SysfsReader.h"
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Keeps the last minute of samples of a block device stat node, taken once a second by
+// StorageDevices on the health loop, so IOPS, throughput, latency and queue depth can be
+// derived over 1s, 10s and 60s. getDiskStats and dump are served from the ring and never
+// read the node themselves.
+class DiskStatsSampler {
+ public:
+  static constexpr std::chrono::seconds kSampleInterval{1};
+
+  explicit DiskStatsSampler(std::string stat_path);
+
+  // Reads the node and records the sample.
+  void Tick();
+  // Copies the latest sample into |stats|. Returns false if none was taken yet.
+  bool Latest(DiskStats *stats);
+  void Dump(int fd);
+
+ private:
+  static constexpr size_t kStatFields = 11;
+  // One more than the samples in the longest window.
+  static constexpr size_t kRingSize = 64;
+
+  struct Snapshot {
+    std::chrono::steady_clock::time_point time;
+    uint64_t fields[kStatFields];
+  };
+
+  struct Rates {
+    double iops;
+    double mbps;
+    // Average request latency, from the read and write ticks.
+    double latency_ms;
+    // Average device service time, from io_ticks.
+    double service_ms;
+    // Time-weighted average number of requests in flight.
+    double depth;
+  };
+
+  static Rates ComputeRates(const Snapshot &from, const Snapshot &to);
+  // Returns the snapshot |age| samples before the latest one. Requires lock_.
+  const Snapshot &SnapshotAt(size_t age) const;
+  void DumpWindow(int fd, const char *name, std::chrono::steady_clock::duration window);
+
+  SysfsNode node_;
+  std::mutex lock_;
+  std::array<Snapshot, kRingSize> ring_;
+  size_t count_ = 0;
+  size_t next_ = 0;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -16,13 +16,25 @@
 #define LOG_TAG "android.hardware.health@2.1-impl-gs201"
 #include <android-base/logging.h>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/parseint.h>
 #include <android-base/strings.h>
+#include <android/binder_manager.h>
+#include <android/binder_process.h>
 #include <android/hardware/health/translate-ndk.h>
 #include <health-impl/Health.h>
 #include <health/utils.h>
 
+#include "BoardUpdate.h"
+#include "CoalescingHealthLoop.h"
+#include "DiskStatsSampler.h"
+#include "HealthLoopTuner.h"
+#include "HealthPaths.h"
+#include "HealthUpdateStats.h"
+#include "StorageDevices.h"
+#include "StorageHealthRefresher.h"
+
 // Recovery doesn't have libpixelhealth and charger mode
 #ifndef __ANDROID_RECOVERY__
 #include <health-impl/ChargerUtils.h>
@@ -33,9 +45,10 @@
 #include <pixelhealth/LowBatteryShutdownMetrics.h>
 #endif // !__ANDROID_RECOVERY__
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <chrono>
-#include <fstream>
-#include <iomanip>
 #include <string>
 #include <vector>
 
@@ -44,9 +57,18 @@ namespace {
 using namespace std::literals;
 
 using aidl::android::hardware::health::DiskStats;
-using aidl::android::hardware::health::HalHealthLoop;
 using aidl::android::hardware::health::HealthInfo;
 using aidl::android::hardware::health::StorageInfo;
+using aidl::android::hardware::health::gs201::BoardUpdate;
+using aidl::android::hardware::health::gs201::CoalescingHealthLoop;
+using aidl::android::hardware::health::gs201::DiskStatsSampler;
+using aidl::android::hardware::health::gs201::HealthLoopTuner;
+using aidl::android::hardware::health::gs201::HealthUpdateStats;
+using aidl::android::hardware::health::gs201::RootedPath;
+using aidl::android::hardware::health::gs201::StorageDevices;
+using aidl::android::hardware::health::gs201::StorageHealthRefresher;
+using android::hardware::health::EVENT_NO_WAKEUP_FD;
+using android::hardware::health::HealthLoop;
 using android::hardware::health::InitHealthdConfig;
 
 #ifndef __ANDROID_RECOVERY__
@@ -59,65 +81,110 @@ using hardware::google::pixel::health::LowBatteryShutdownMetrics;
 using hardware::google::pixel::health::ChargerDetect;
 
 #define FG_DIR "/sys/class/power_supply/battery"
-constexpr char kBatteryResistance[] {FG_DIR "/resistance"};
-constexpr char kBatteryOCV[] {FG_DIR "/voltage_ocv"};
-constexpr char kVoltageAvg[] {FG_DIR "/voltage_now"};
+// The loggers keep the raw pointers, so these live for the whole process.
+static const std::string kBatteryResistance = RootedPath(FG_DIR "/resistance");
+static const std::string kBatteryOCV = RootedPath(FG_DIR "/voltage_ocv");
+static const std::string kVoltageAvg = RootedPath(FG_DIR "/voltage_now");
 
 #define WLC_DIR "/sys/class/power_supply/wireless"
 
-static BatteryDefender battDefender(WLC_DIR "/present",
-    "/sys/devices/platform/google,charger/charge_start_level",
-    "/sys/devices/platform/google,charger/charge_stop_level");
-static BatteryMetricsLogger battMetricsLogger(kBatteryResistance, kBatteryOCV);
-static LowBatteryShutdownMetrics shutdownMetrics(kVoltageAvg);
-static DeviceHealth deviceHealth;
-#endif // !__ANDROID_RECOVERY__
+// The pixel health components probe sysfs when constructed, so they are built on the
+// loop thread when first used rather than before main. Battery metrics are reported to
+// the stats service, which does not run in charger mode, so that logger is never built
+// there.
+static bool charger_mode = false;
+static bool needs_wlc_updates = false;
 
-#define UFS_DIR "/dev/sys/block/bootdevice"
-constexpr char kUfsHealthEol[]{UFS_DIR "/health_descriptor/eol_info"};
-constexpr char kUfsHealthLifetimeA[]{UFS_DIR "/health_descriptor/life_time_estimation_a"};
-constexpr char kUfsHealthLifetimeB[]{UFS_DIR "/health_descriptor/life_time_estimation_b"};
-constexpr char kUfsVersion[]{UFS_DIR "/device_descriptor/specification_version"};
-constexpr char kDiskStatsFile[]{"/sys/block/sda/stat"};
-
-static std::string ufs_version;
-static uint16_t eol;
-static uint16_t lifetimeA;
-static uint16_t lifetimeB;
-static std::chrono::system_clock::time_point ufs_last_query_time;
-constexpr auto kUfsQueryIntervalHours = std::chrono::hours{24};
+static BatteryDefender &battDefender() {
+  static BatteryDefender instance(RootedPath(WLC_DIR "/present"),
+      RootedPath("/sys/devices/platform/google,charger/charge_start_level"),
+      RootedPath("/sys/devices/platform/google,charger/charge_stop_level"));
+  static bool configured = [] {
+    if (needs_wlc_updates == false) {
+      instance.setWirelessNotSupported();
+    }
+    return true;
+  }();
+  (void)configured;
+  return instance;
+}
 
-#ifndef __ANDROID_RECOVERY__
-static bool needs_wlc_updates = false;
-constexpr char kWlcCapacity[]{WLC_DIR "/capacity"};
-#endif // !__ANDROID_RECOVERY__
+static BatteryMetricsLogger &battMetricsLogger() {
+  static BatteryMetricsLogger instance(kBatteryResistance.c_str(), kBatteryOCV.c_str());
+  return instance;
+}
 
-std::ifstream assert_open(const std::string &path) {
-  std::ifstream stream(path);
-  if (!stream.is_open()) {
-    LOG(WARNING) << "Cannot read " << path;
-  }
-  return stream;
+static LowBatteryShutdownMetrics &shutdownMetrics() {
+  static LowBatteryShutdownMetrics instance(kVoltageAvg.c_str());
+  return instance;
 }
 
-template <typename T>
-void read_value_from_file(const std::string &path, T *field) {
-  auto stream = assert_open(path);
-  stream.unsetf(std::ios_base::basefield);
-  stream >> *field;
+static DeviceHealth &deviceHealth() {
+  static DeviceHealth instance;
+  return instance;
 }
 
-void read_ufs_version(StorageInfo *info) {
-  if (ufs_version.empty()) {
-    uint64_t value;
-    read_value_from_file(kUfsVersion, &value);
-    std::stringstream ss;
-    ss << "ufs " << std::hex << value;
-    ufs_version = ss.str();
-    LOG(INFO) << "ufs: " << ufs_version << " detected";
-  }
-  info->version = ufs_version;
+// DeviceHealth and BatteryDefender shape HealthInfo, so the first update builds them.
+// The loggers only record it and are built once the first HealthInfo is out: by the
+// loop heartbeat that follows the first update in normal mode, or by the next update
+// in charger mode, whose loop has no heartbeat hook.
+static bool loggers_ready = false;
+
+static void BuildLoggers() {
+  if (loggers_ready) return;
+  if (!charger_mode) battMetricsLogger();
+  shutdownMetrics();
+  loggers_ready = true;
 }
+#endif // !__ANDROID_RECOVERY__
+
+// Logs the time from exec to the first HealthInfo produced by this process.
+static void LogFirstHealthInfo(const char *mode) {
+  static bool logged = false;
+  if (logged) return;
+  logged = true;
+
+  // Field 22 of /proc/self/stat is the process start time in clock ticks since boot.
+  std::string stat;
+  if (!android::base::ReadFileToString("/proc/self/stat", &stat)) return;
+  auto comm_end = stat.rfind(')');
+  if (comm_end == std::string::npos) return;
+  std::vector<std::string> fields = android::base::Split(stat.substr(comm_end + 2), " ");
+  uint64_t start_ticks;
+  if (fields.size() < 20 || !android::base::ParseUint(fields[19], &start_ticks)) return;
+
+  auto start = std::chrono::milliseconds(start_ticks * 1000 / sysconf(_SC_CLK_TCK));
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      android::base::boot_clock::now().time_since_epoch());
+  LOG(INFO) << "First HealthInfo in " << mode << " mode " << (now - start).count()
+            << "ms after exec";
+}
+
+#define UFS_DIR "/dev/sys/block/bootdevice"
+#define SYS_BLOCK_DIR "/sys/block"
+constexpr char kBootDevice[]{"sda"};
+static const std::string kDiskStatsFile = RootedPath(SYS_BLOCK_DIR "/sda/stat");
+constexpr auto kUfsQueryIntervalHours = std::chrono::hours{24};
+
+static DiskStatsSampler disk_stats_sampler(kDiskStatsFile);
+static StorageHealthRefresher storage_health(RootedPath(UFS_DIR), kUfsQueryIntervalHours);
+static StorageDevices storage_devices(RootedPath(SYS_BLOCK_DIR), kBootDevice,
+                                      &disk_stats_sampler);
+
+// Charger and wireless drivers emit bursts of power_supply uevents while charging.
+constexpr auto kUeventCoalesceWindow = std::chrono::milliseconds{200};
+static HealthLoopTuner loop_tuner(kUeventCoalesceWindow);
+
+#ifndef __ANDROID_RECOVERY__
+static const std::string kWlcCapacity = RootedPath(WLC_DIR "/capacity");
+
+// Updates slower than this are logged with their per-stage breakdown.
+constexpr auto kSlowUpdateThreshold = std::chrono::milliseconds{100};
+static HealthUpdateStats update_stats(kSlowUpdateThreshold);
+
+static BoardUpdate board_update(RootedPath("/data/vendor/health/battery_history"),
+                                RootedPath(FG_DIR), kWlcCapacity, &update_stats);
+#endif // !__ANDROID_RECOVERY__
 
 #ifdef __ANDROID_RECOVERY__
 void private_healthd_board_init(struct healthd_config *) {}
@@ -135,24 +202,39 @@ void private_healthd_board_init(struct healthd_config *hc) {
   ChargerDetect::populateTcpmPsyName(&tcpmPsyName);
   hc->ignorePowerSupplyNames.push_back(android::String8(tcpmPsyName.c_str()));
   needs_wlc_updates = FileExists(kWlcCapacity);
-  if (needs_wlc_updates == false) {
-    battDefender.setWirelessNotSupported();
-  }
+  board_update.set_wlc_updates(needs_wlc_updates);
 }
 
 int private_healthd_board_battery_update(HealthInfo *health_info) {
-  int batt_level;
-  deviceHealth.update(health_info);
-  battMetricsLogger.logBatteryProperties(*health_info);
-  shutdownMetrics.logShutdownVoltage(*health_info);
+  static bool first_update = true;
+  HealthUpdateStats::ScopedStage total(&update_stats, HealthUpdateStats::kTotal);
+
+  if (!first_update) BuildLoggers();
+  first_update = false;
+  {
+    HealthUpdateStats::ScopedStage stage(&update_stats, HealthUpdateStats::kDeviceHealth);
+    deviceHealth().update(health_info);
+  }
+  if (loggers_ready && !charger_mode) {
+    HealthUpdateStats::ScopedStage stage(&update_stats, HealthUpdateStats::kBatteryMetrics);
+    battMetricsLogger().logBatteryProperties(*health_info);
+  }
+  if (loggers_ready) {
+    HealthUpdateStats::ScopedStage stage(&update_stats, HealthUpdateStats::kShutdownMetrics);
+    shutdownMetrics().logShutdownVoltage(*health_info);
+  }
   // Allow BatteryDefender to override online properties
-  ChargerDetect::onlineUpdate(health_info);
-  battDefender.update(health_info);
+  {
+    HealthUpdateStats::ScopedStage stage(&update_stats, HealthUpdateStats::kChargerDetect);
+    ChargerDetect::onlineUpdate(health_info);
+  }
+  {
+    HealthUpdateStats::ScopedStage stage(&update_stats, HealthUpdateStats::kBatteryDefender);
+    battDefender().update(health_info);
+  }
 
-  batt_level = (health_info->batteryStatus == ::aidl::android::hardware::health::BatteryStatus::FULL) ? 101 : health_info->batteryLevel;
-  if (needs_wlc_updates &&
-      !android::base::WriteStringToFile(std::to_string(batt_level), kWlcCapacity))
-      LOG(INFO) << "Unable to write battery level to wireless capacity";
+  // /data is not mounted in charger mode, so the history is only kept in normal mode.
+  board_update.Update(*health_info, !charger_mode);
 
   return 0;
 }
@@ -162,35 +244,17 @@ void private_get_storage_info(std::vector<StorageInfo> *vec_storage_info) {
   vec_storage_info->resize(1);
   StorageInfo *storage_info = &vec_storage_info->at(0);
 
-  read_ufs_version(storage_info);
-
-  auto time_now = std::chrono::system_clock::now();
-  auto time_delta = time_now - ufs_last_query_time;
-  auto hoursElapsed = std::chrono::duration_cast<std::chrono::hours>(time_delta);
-  if (hoursElapsed >= kUfsQueryIntervalHours) {
-    ufs_last_query_time = time_now;
-    read_value_from_file(kUfsHealthEol, &eol);
-    read_value_from_file(kUfsHealthLifetimeA, &lifetimeA);
-    read_value_from_file(kUfsHealthLifetimeB, &lifetimeB);
-    LOG(INFO) << "ufs: eol=" << eol << " lifetimeA=" << lifetimeA << " lifetimeB=" << lifetimeB;
-  }
-  storage_info->eol = eol;
-  storage_info->lifetimeA = lifetimeA;
-  storage_info->lifetimeB = lifetimeB;
+  storage_health.Get(storage_info);
+  storage_devices.GetUsbStorageInfo(vec_storage_info);
 
   return;
 }
 
 void private_get_disk_stats(std::vector<DiskStats> *vec_stats) {
-  vec_stats->resize(1);
-  DiskStats *stats = &vec_stats->at(0);
-
-  auto stream = assert_open(kDiskStatsFile);
-  // Regular diskstats entries
-  stream >> stats->reads >> stats->readMerges >> stats->readSectors >>
-      stats->readTicks >> stats->writes >> stats->writeMerges >>
-      stats->writeSectors >> stats->writeTicks >> stats->ioInFlight >>
-      stats->ioTicks >> stats->ioInQueue;
+  vec_stats->clear();
+
+  // Served from the last samples taken on the health loop; nothing is read here.
+  storage_devices.GetDiskStats(vec_stats);
   return;
 }
 }  // anonymous namespace
@@ -199,20 +263,65 @@ namespace aidl::android::hardware::health::implementation {
 class HealthImpl : public Health {
  public:
   HealthImpl(std::string_view instance_name, std::unique_ptr<healthd_config>&& config)
-    : Health(std::move(instance_name), std::move(config)) {}
+    : Health(instance_name, std::make_unique<healthd_config>(*config)),
+      instance_name_(instance_name),
+      config_(*config) {}
 
     ndk::ScopedAStatus getDiskStats(std::vector<DiskStats>* out) override;
     ndk::ScopedAStatus getStorageInfo(std::vector<StorageInfo>* out) override;
+    binder_status_t dump(int fd, const char** args, uint32_t num_args) override;
+
+    // Initializes the service on a CoalescingHealthLoop, as Health::OnInit does on a
+    // HalHealthLoop.
+    void OnLoopInit(HealthLoop* loop, struct healthd_config* config);
+#ifndef __ANDROID_RECOVERY__
+    void OnHeartbeat() override;
+#endif // !__ANDROID_RECOVERY__
 
  protected:
   void UpdateHealthInfo(HealthInfo* health_info) override;
 
+ private:
+  const std::string instance_name_;
+  const healthd_config config_;
 };
 
 void HealthImpl::UpdateHealthInfo(HealthInfo* health_info) {
   private_healthd_board_battery_update(health_info);
+#ifdef __ANDROID_RECOVERY__
+  LogFirstHealthInfo("recovery");
+#else
+  LogFirstHealthInfo(charger_mode ? "charger" : "normal");
+#endif
+}
+
+void HealthImpl::OnLoopInit(HealthLoop* loop, struct healthd_config* config) {
+  *config = config_;
+
+  int binder_fd = -1;
+  if (ABinderProcess_setupPolling(&binder_fd) == STATUS_OK && binder_fd >= 0) {
+    if (loop->RegisterEvent(
+            binder_fd, [](HealthLoop*, uint32_t) { ABinderProcess_handlePolledCommands(); },
+            EVENT_NO_WAKEUP_FD) != 0) {
+      PLOG(ERROR) << instance_name_ << " instance: Register for binder events failed";
+    }
+  }
+
+  std::string health_instance_name = std::string(IHealth::descriptor) + "/" + instance_name_;
+  CHECK_EQ(STATUS_OK, AServiceManager_addService(this->asBinder().get(),
+                                                 health_instance_name.c_str()))
+      << instance_name_ << ": Failed to register HAL";
+
+  storage_devices.Attach(loop);
 }
 
+#ifndef __ANDROID_RECOVERY__
+void HealthImpl::OnHeartbeat() {
+  // The first heartbeat follows the first update.
+  BuildLoggers();
+}
+#endif // !__ANDROID_RECOVERY__
+
 ndk::ScopedAStatus HealthImpl::getStorageInfo(std::vector<StorageInfo>* out)
 {
   private_get_storage_info(out);
@@ -231,6 +340,20 @@ ndk::ScopedAStatus HealthImpl::getDiskStats(std::vector<DiskStats>* out)
   return ndk::ScopedAStatus::ok();
 }
 
+binder_status_t HealthImpl::dump(int fd, const char** args, uint32_t num_args)
+{
+  binder_status_t status = Health::dump(fd, args, num_args);
+  storage_devices.Dump(fd);
+  disk_stats_sampler.Dump(fd);
+  loop_tuner.Dump(fd);
+#ifndef __ANDROID_RECOVERY__
+  dprintf(fd, "Sysfs outputs:\n");
+  board_update.Dump(fd);
+  update_stats.Dump(fd);
+#endif // !__ANDROID_RECOVERY__
+  return status;
+}
+
 }  // namespace aidl::android::hardware::health::implementation
 
 int main(int argc, char **argv) {
@@ -241,6 +364,11 @@ int main(int argc, char **argv) {
   android::base::InitLogging(argv, android::base::KernelLogger);
 #endif
 
+  bool charger_arg = argc >= 2 && argv[1] == "--charger"sv;
+#ifndef __ANDROID_RECOVERY__
+  charger_mode = charger_arg;
+#endif
+
   auto config = std::make_unique<healthd_config>();
   InitHealthdConfig(config.get());
 
@@ -249,7 +377,7 @@ int main(int argc, char **argv) {
   auto binder =
       ndk::SharedRefBase::make<HealthImpl>("default"sv, std::move(config));
 
-  if (argc >= 2 && argv[1] == "--charger"sv) {
+  if (charger_arg) {
     // In regular mode, start charger UI.
 #ifndef __ANDROID_RECOVERY__
     LOG(INFO) << "Starting charger mode with UI.";
@@ -259,8 +387,12 @@ int main(int argc, char **argv) {
     LOG(INFO) << "Starting charger mode without UI.";
   } else {
     LOG(INFO) << "Starting health HAL.";
+    storage_health.Start();
   }
 
-  auto hal_health_loop = std::make_shared<HalHealthLoop>(binder, binder);
-  return hal_health_loop->StartLoop();
+  auto health_loop = std::make_shared<CoalescingHealthLoop>(
+      binder, binder, &loop_tuner, [binder](HealthLoop* loop, struct healthd_config* config) {
+        binder->OnLoopInit(loop, config);
+      });
+  return health_loop->StartLoop();
 }
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "HealthLoopTuner.h"
+
+#include <android-base/logging.h>
+#include <stdio.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cstdlib>
+
+namespace aidl::android::hardware::health::gs201 {
+
+using ::android::base::boot_clock;
+using ::android::hardware::health::EVENT_WAKEUP_FD;
+using ::android::hardware::health::HealthLoop;
+
+namespace {
+
+// Levels close enough to empty or full that charging decisions are imminent.
+constexpr int kLowLevel = 10;
+constexpr int kHighLevel = 90;
+// Discharge below this current (uA) with the level moving slower than kSteadyRate is
+// treated as an idle device, typically with the screen off.
+constexpr int kIdleCurrentUa = 100000;
+constexpr double kSteadyRate = 5.0;  // percent per hour
+// A level change more than this far apart restarts the rate measurement.
+constexpr auto kMaxRateWindow = std::chrono::hours{4};
+
+}  // namespace
+
+HealthLoopTuner::HealthLoopTuner(std::chrono::milliseconds coalesce_window)
+    : coalesce_window_(coalesce_window) {}
+
+void HealthLoopTuner::Attach(HealthLoop *loop, healthd_config *config,
+                             std::function<void()> deferred_update) {
+  config_ = config;
+  base_fast_seconds_ = config->periodic_chores_interval_fast;
+  base_slow_seconds_ = config->periodic_chores_interval_slow;
+  deferred_update_ = std::move(deferred_update);
+
+  // An alarm, like the loop's own wake alarm, so that a trailing update deferred just
+  // before suspend still runs within the window and is not held until the next resume.
+  // The charger service lacks CAP_WAKE_ALARM; it falls back to the boottime clock.
+  timer_fd_.reset(timerfd_create(CLOCK_BOOTTIME_ALARM, TFD_NONBLOCK | TFD_CLOEXEC));
+  if (timer_fd_ == -1) {
+    PLOG(WARNING) << "timerfd_create(CLOCK_BOOTTIME_ALARM) failed, trying CLOCK_BOOTTIME";
+    timer_fd_.reset(timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC));
+  }
+  if (timer_fd_ == -1) {
+    PLOG(ERROR) << "timerfd_create failed, uevents will not be coalesced";
+    return;
+  }
+  // A wakeup fd holds off suspend from the expiry until the update has run.
+  if (loop->RegisterEvent(
+              timer_fd_, [this](HealthLoop *, uint32_t) { OnTimer(); }, EVENT_WAKEUP_FD)) {
+    LOG(ERROR) << "Unable to register coalescing timer, uevents will not be coalesced";
+    timer_fd_.reset();
+  }
+}
+
+bool HealthLoopTuner::ShouldDefer() {
+  auto now = boot_clock::now();
+
+  if (timer_fd_ == -1) {
+    updates_++;
+    return false;
+  }
+  if (timer_armed_) {
+    coalesced_requests_++;
+    return true;
+  }
+  if (last_update_ && now - *last_update_ < coalesce_window_) {
+    ArmTimer(*last_update_ + coalesce_window_);
+    coalesced_requests_++;
+    return true;
+  }
+  last_update_ = now;
+  updates_++;
+  return false;
+}
+
+void HealthLoopTuner::ArmTimer(boot_clock::time_point when) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+    PLOG(ERROR) << "timerfd_settime failed";
+    return;
+  }
+  timer_armed_ = true;
+}
+
+void HealthLoopTuner::OnTimer() {
+  uint64_t expirations;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+
+  timer_armed_ = false;
+  last_update_ = boot_clock::now();
+  updates_++;
+  deferred_updates_++;
+  deferred_update_();
+}
+
+void HealthLoopTuner::SetIntervals(int fast_seconds, int slow_seconds) {
+  if (config_->periodic_chores_interval_fast == fast_seconds &&
+      config_->periodic_chores_interval_slow == slow_seconds)
+    return;
+
+  LOG(INFO) << "Periodic chores interval fast=" << fast_seconds << "s slow=" << slow_seconds
+            << "s (level rate " << level_rate_ << "%/h)";
+  config_->periodic_chores_interval_fast = fast_seconds;
+  config_->periodic_chores_interval_slow = slow_seconds;
+}
+
+void HealthLoopTuner::OnHealthInfoChanged(const HealthInfo &health_info) {
+  if (config_ == nullptr) return;
+
+  auto now = boot_clock::now();
+  int level = health_info.batteryLevel;
+  if (level != last_level_) {
+    if (last_level_ >= 0 && last_level_change_ && now - *last_level_change_ < kMaxRateWindow) {
+      std::chrono::duration<double, std::ratio<3600>> hours = now - *last_level_change_;
+      level_rate_ = std::abs(level - last_level_) / hours.count();
+    } else {
+      // Unknown until the next change; assume it is moving.
+      level_rate_ = kSteadyRate;
+    }
+    last_level_ = level;
+    last_level_change_ = now;
+  }
+
+  // The fast interval is used while a charger is online, the slow one otherwise.
+  int fast = base_fast_seconds_;
+  int slow = base_slow_seconds_;
+  if (fast > 0 && (level <= kLowLevel || level >= kHighLevel)) fast /= 2;
+
+  bool idle = std::abs(health_info.batteryCurrentMicroamps) < kIdleCurrentUa &&
+              level_rate_ < kSteadyRate && level > kLowLevel;
+  if (slow > 0 && idle) slow *= 2;
+
+  SetIntervals(fast, slow);
+}
+
+void HealthLoopTuner::Dump(int fd) {
+  dprintf(fd, "Health loop: %" PRIu64 " updates (%" PRIu64 " deferred), %" PRIu64
+              " requests coalesced within %lldms\n",
+          updates_, deferred_updates_, coalesced_requests_,
+          static_cast<long long>(coalesce_window_.count()));
+  if (config_ != nullptr) {
+    dprintf(fd, "  periodic chores fast=%ds slow=%ds, level rate %.1f%%/h\n",
+            config_->periodic_chores_interval_fast, config_->periodic_chores_interval_slow,
+            level_rate_);
+  }
+}
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/health/HealthInfo.h>
+#include <android-base/chrono_utils.h>
+#include <android-base/unique_fd.h>
+#include <health/HealthLoop.h>
+#include <healthd/healthd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Tunes the health loop for gs201, see CoalescingHealthLoop:
+//  - Coalesces bursts of battery updates, mostly from power_supply uevents. The first
+//    update of a burst runs immediately; further requests within the window are
+//    folded into a single trailing update when the window closes.
+//  - Picks the periodic chores intervals from the charge state and the rate at which
+//    the battery level moves, instead of the fixed fast/slow pair.
+// All methods run on the health loop thread.
+class HealthLoopTuner {
+ public:
+  HealthLoopTuner(std::chrono::milliseconds coalesce_window);
+
+  // |config| is the configuration the loop was initialized with; the loop keeps
+  // reading its periodic intervals from it. |deferred_update| runs the trailing update
+  // of a coalesced burst through the loop's update path.
+  void Attach(::android::hardware::health::HealthLoop *loop, healthd_config *config,
+              std::function<void()> deferred_update);
+  // Returns true if the update should be folded into a pending trailing update.
+  bool ShouldDefer();
+  void OnHealthInfoChanged(const HealthInfo &health_info);
+  void Dump(int fd);
+
+ private:
+  void OnTimer();
+  void ArmTimer(::android::base::boot_clock::time_point when);
+  void SetIntervals(int fast_seconds, int slow_seconds);
+
+  const std::chrono::milliseconds coalesce_window_;
+  ::android::base::unique_fd timer_fd_;
+  healthd_config *config_ = nullptr;
+  std::function<void()> deferred_update_;
+
+  int base_fast_seconds_ = 0;
+  int base_slow_seconds_ = 0;
+
+  std::optional<::android::base::boot_clock::time_point> last_update_;
+  bool timer_armed_ = false;
+
+  // Battery level tracking for the rate of change.
+  int last_level_ = -1;
+  std::optional<::android::base::boot_clock::time_point> last_level_change_;
+  // Percent per hour measured between the last two level changes.
+  double level_rate_ = 0;
+
+  uint64_t updates_ = 0;
+  uint64_t deferred_updates_ = 0;
+  uint64_t coalesced_requests_ = 0;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
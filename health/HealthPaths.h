@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdlib.h>
+
+#include <string>
+#include <string_view>
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Environment variable naming a directory that the HAL's own sysfs and data paths are
+// resolved under, so that it can run against a fake tree off-device. init never sets
+// it. Paths read by libhealthloop's BatteryMonitor are not affected.
+constexpr char kHealthRootEnv[] = "GS201_HEALTH_ROOT";
+
+inline std::string RootedPath(std::string_view path) {
+  static const std::string root = [] {
+    const char *value = getenv(kHealthRootEnv);
+    return std::string(value ? value : "");
+  }();
+  return root + std::string(path);
+}
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#define ATRACE_TAG ATRACE_TAG_POWER
+#include "HealthUpdateStats.h"
+
+#include <android-base/logging.h>
+#include <cutils/trace.h>
+#include <stdio.h>
+
+#include <cinttypes>
+#include <sstream>
+
+namespace aidl::android::hardware::health::gs201 {
+
+using ::android::hardware::google::gs201::StageWindow;
+
+HealthUpdateStats::HealthUpdateStats(std::chrono::milliseconds slow_threshold)
+    : slow_threshold_us_(std::chrono::microseconds(slow_threshold).count()) {}
+
+const char *HealthUpdateStats::StageName(Stage stage) {
+  switch (stage) {
+    case kDeviceHealth:
+      return "device_health";
+    case kBatteryMetrics:
+      return "battery_metrics";
+    case kShutdownMetrics:
+      return "shutdown_metrics";
+    case kChargerDetect:
+      return "charger_detect";
+    case kBatteryDefender:
+      return "battery_defender";
+    case kWlcCapacity:
+      return "wlc_capacity";
+    case kTotal:
+      return "total";
+    default:
+      return "unknown";
+  }
+}
+
+void HealthUpdateStats::Record(Stage stage, int64_t duration_us) {
+  std::lock_guard<std::mutex> lock(lock_);
+
+  windows_[stage].add(std::chrono::microseconds(duration_us));
+  current_us_[stage] = duration_us;
+
+  if (stage != kTotal) return;
+
+  updates_++;
+  if (duration_us >= slow_threshold_us_) {
+    slow_updates_++;
+    std::ostringstream breakdown;
+    for (int i = 0; i < kTotal; i++) {
+      breakdown << " " << StageName(static_cast<Stage>(i)) << "=" << current_us_[i] / 1000
+                << "ms";
+    }
+    LOG(WARNING) << "Slow health update: " << duration_us / 1000 << "ms," << breakdown.str();
+  }
+  current_us_.fill(0);
+}
+
+void HealthUpdateStats::Dump(int fd) {
+  std::lock_guard<std::mutex> lock(lock_);
+
+  dprintf(fd, "Health update latency: %" PRIu64 " updates, %" PRIu64 " slower than %" PRId64
+              "ms\n", updates_, slow_updates_, slow_threshold_us_ / 1000);
+  dprintf(fd, "  (last %d samples, %s)\n", StageWindow::kWindowSize,
+          StageWindow::bucketLegend());
+  for (int stage = 0; stage < kStageCount; stage++)
+    windows_[stage].dump(fd, "  ", StageName(static_cast<Stage>(stage)));
+}
+
+HealthUpdateStats::ScopedStage::ScopedStage(HealthUpdateStats *stats, Stage stage)
+    : stats_(stats), stage_(stage), timer_(ATRACE_TAG, StageName(stage)) {}
+
+HealthUpdateStats::ScopedStage::~ScopedStage() {
+  stats_->Record(stage_, timer_.elapsed().count());
+}
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <StageStats.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Times each stage of a health update on the monotonic clock and keeps a rolling
+// StageWindow per stage. Updates slower than the threshold are logged with their
+// per-stage breakdown.
+class HealthUpdateStats {
+ public:
+  enum Stage {
+    kDeviceHealth = 0,
+    kBatteryMetrics,
+    kShutdownMetrics,
+    kChargerDetect,
+    kBatteryDefender,
+    kWlcCapacity,
+    kTotal,
+    kStageCount,
+  };
+
+  // Times a stage and emits it as an atrace span for the lifetime of the object.
+  class ScopedStage {
+   public:
+    ScopedStage(HealthUpdateStats *stats, Stage stage);
+    ~ScopedStage();
+
+   private:
+    HealthUpdateStats *stats_;
+    Stage stage_;
+    ::android::hardware::google::gs201::ScopedStageTimer timer_;
+  };
+
+  explicit HealthUpdateStats(std::chrono::milliseconds slow_threshold);
+
+  void Dump(int fd);
+  static const char *StageName(Stage stage);
+
+ private:
+  void Record(Stage stage, int64_t duration_us);
+
+  const int64_t slow_threshold_us_;
+  std::mutex lock_;
+  std::array<::android::hardware::google::gs201::StageWindow, kStageCount> windows_;
+  // Durations of the update in progress, logged if the update turns out slow.
+  std::array<int64_t, kStageCount> current_us_ = {};
+  uint64_t updates_ = 0;
+  uint64_t slow_updates_ = 0;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
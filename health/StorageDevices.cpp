@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "StorageDevices.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <cutils/uevent.h>
+#include <dirent.h>
+#include <linux/filter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+namespace aidl::android::hardware::health::gs201 {
+
+using ::android::hardware::health::EVENT_NO_WAKEUP_FD;
+using ::android::hardware::health::HealthLoop;
+
+namespace {
+
+constexpr int kUeventBufferSize = 64 * 1024;
+constexpr size_t kDiskStatsFields = 11;
+
+// Accepts only kernel uevents whose header is "add@" or "remove@", so the bursts of
+// power_supply change events that the health loop already handles do not wake it again
+// through this socket. The subsystem sits at a variable offset, so OnUevent() checks it.
+const sock_filter kAddRemoveFilter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x61646440 /* "add@" */, 5, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x72656d6f /* "remo" */, 0, 5),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x7665 /* "ve" */, 0, 3),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, '@', 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+// The boot device gets a key sorting before any block device name.
+std::string DeviceKey(const std::string &name, const std::string &boot_device) {
+  return name == boot_device ? std::string() : name;
+}
+
+}  // namespace
+
+StorageDevices::StorageDevices(std::string sys_block_dir, std::string boot_device,
+                               DiskStatsSampler *boot_sampler)
+    : sys_block_dir_(std::move(sys_block_dir)),
+      boot_device_(std::move(boot_device)),
+      boot_sampler_(boot_sampler) {}
+
+void StorageDevices::Attach(HealthLoop *loop) {
+  // The monotonic clock stops in suspend, so the timer neither wakes the device nor
+  // catches up on resume, and the sampled windows only cover time spent awake.
+  timer_fd_.reset(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = DiskStatsSampler::kSampleInterval.count();
+  spec.it_interval = spec.it_value;
+  if (timer_fd_ == -1 || timerfd_settime(timer_fd_, 0, &spec, nullptr) == -1 ||
+      loop->RegisterEvent(
+              timer_fd_, [this](HealthLoop *, uint32_t) { OnTimer(); }, EVENT_NO_WAKEUP_FD)) {
+    PLOG(ERROR) << "Unable to start the disk stats timer, disk stats are not sampled";
+    timer_fd_.reset();
+  }
+  // Take the first samples now so that early requests have something to report.
+  boot_sampler_->Tick();
+  Refresh();
+
+  uevent_fd_.reset(uevent_open_socket(kUeventBufferSize, true));
+  if (uevent_fd_ == -1) {
+    LOG(ERROR) << "Unable to open uevent socket, storage hotplug is not tracked";
+    return;
+  }
+  sock_fprog filter = {static_cast<unsigned short>(std::size(kAddRemoveFilter)),
+                       const_cast<sock_filter *>(kAddRemoveFilter)};
+  if (setsockopt(uevent_fd_, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == -1) {
+    // Still correct without the filter, OnUevent() drops the other events.
+    PLOG(WARNING) << "Unable to filter the storage uevent socket";
+  }
+  if (loop->RegisterEvent(
+              uevent_fd_, [this](HealthLoop *, uint32_t) { OnUevent(); }, EVENT_NO_WAKEUP_FD)) {
+    LOG(ERROR) << "Unable to register uevent socket, storage hotplug is not tracked";
+    uevent_fd_.reset();
+  }
+}
+
+void StorageDevices::OnUevent() {
+  // The socket is blocking; the loop calls back once per pending message.
+  char msg[2048];
+  ssize_t len = uevent_kernel_multicast_recv(uevent_fd_, msg, sizeof(msg) - 1);
+  if (len <= 0) return;
+  msg[len] = '\0';
+
+  bool block = false, disk = false, add_remove = false;
+  for (char *cp = msg; cp < msg + len; cp += strlen(cp) + 1) {
+    std::string_view field(cp);
+    if (field == "SUBSYSTEM=block") block = true;
+    if (field == "DEVTYPE=disk") disk = true;
+    if (field == "ACTION=add" || field == "ACTION=remove") add_remove = true;
+  }
+  if (!block || !disk || !add_remove) return;
+
+  std::lock_guard<std::mutex> lock(lock_);
+  ScanLocked();
+}
+
+void StorageDevices::ScanLocked() {
+  std::map<std::string, Device> devices;
+  std::unique_ptr<DIR, int (*)(DIR *)> dir(opendir(sys_block_dir_.c_str()), closedir);
+  if (!dir) PLOG(ERROR) << "Unable to open " << sys_block_dir_;
+
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir.get())) != nullptr) {
+    std::string name = entry->d_name;
+    if (name[0] == '.') continue;
+
+    // The link target tells which bus the disk is on; virtual devices are skipped.
+    std::string path = sys_block_dir_ + "/" + name;
+    std::string target;
+    if (!::android::base::Realpath(path, &target)) continue;
+    Kind kind;
+    if (target.find("/usb") != std::string::npos) {
+      kind = Kind::kUsb;
+    } else if (target.find(".ufs/") != std::string::npos) {
+      kind = Kind::kUfs;
+    } else if (name != boot_device_) {
+      continue;
+    } else {
+      kind = Kind::kUfs;
+    }
+
+    std::string key = DeviceKey(name, boot_device_);
+    // Keep the open stat fd of devices that are still present.
+    auto existing = devices_.find(key);
+    if (existing != devices_.end()) {
+      devices.emplace(key, std::move(existing->second));
+      continue;
+    }
+
+    Device device{kind, std::make_unique<SysfsNode>(path + "/stat"), {}, {}};
+    if (kind == Kind::kUsb) {
+      ::android::base::ReadFileToString(path + "/device/model", &device.model);
+      device.model = ::android::base::Trim(device.model);
+    }
+    LOG(INFO) << "Storage device " << name << (kind == Kind::kUsb ? " (usb)" : " (ufs)");
+    devices.emplace(key, std::move(device));
+  }
+
+  // The boot device is always reported, even if the directory could not be read.
+  if (devices.find(DeviceKey(boot_device_, boot_device_)) == devices.end()) {
+    devices.emplace(DeviceKey(boot_device_, boot_device_),
+                    Device{Kind::kUfs,
+                           std::make_unique<SysfsNode>(sys_block_dir_ + "/" + boot_device_ +
+                                                       "/stat"),
+                           {},
+                           {}});
+  }
+
+  devices_ = std::move(devices);
+  scanned_ = true;
+}
+
+void StorageDevices::OnTimer() {
+  uint64_t expirations;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+  boot_sampler_->Tick();
+  Refresh();
+}
+
+void StorageDevices::Refresh() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!scanned_) ScanLocked();
+
+  for (auto &[key, device] : devices_) {
+    if (key.empty()) continue;
+
+    uint64_t fields[kDiskStatsFields] = {};
+    device.stat->ReadInts(fields, kDiskStatsFields);
+    DiskStats &entry = device.stats;
+    entry.reads = fields[0];
+    entry.readMerges = fields[1];
+    entry.readSectors = fields[2];
+    entry.readTicks = fields[3];
+    entry.writes = fields[4];
+    entry.writeMerges = fields[5];
+    entry.writeSectors = fields[6];
+    entry.writeTicks = fields[7];
+    entry.ioInFlight = fields[8];
+    entry.ioTicks = fields[9];
+    entry.ioInQueue = fields[10];
+  }
+}
+
+void StorageDevices::GetDiskStats(std::vector<DiskStats> *stats) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!scanned_) ScanLocked();
+
+  for (const auto &[key, device] : devices_) {
+    DiskStats &entry = stats->emplace_back(device.stats);
+    if (key.empty()) boot_sampler_->Latest(&entry);
+  }
+}
+
+void StorageDevices::GetUsbStorageInfo(std::vector<StorageInfo> *infos) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!scanned_) ScanLocked();
+
+  for (const auto &[key, device] : devices_) {
+    if (device.kind != Kind::kUsb) continue;
+    // USB mass storage reports no wear information, so eol and lifetimeA/B are left 0,
+    // which StorageInfo defines as undefined.
+    StorageInfo &info = infos->emplace_back();
+    info.version = device.model.empty() ? "usb" : "usb " + device.model;
+  }
+}
+
+void StorageDevices::Dump(int fd) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!scanned_) ScanLocked();
+
+  dprintf(fd, "Storage devices (getDiskStats order):\n");
+  for (const auto &[key, device] : devices_) {
+    dprintf(fd, "  %s %s%s%s\n", key.empty() ? boot_device_.c_str() : key.c_str(),
+            device.kind == Kind::kUsb ? "usb" : "ufs", device.model.empty() ? "" : " ",
+            device.model.c_str());
+  }
+}
+
+}  // namespace aidl::android::hardware::health::gs201
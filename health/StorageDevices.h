@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/health/DiskStats.h>
+#include <aidl/android/hardware/health/StorageInfo.h>
+#include <android-base/unique_fd.h>
+#include <health/HealthLoop.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DiskStatsSampler.h"
+#include "SysfsReader.h"
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Tracks the UFS LUNs and USB mass storage disks under /sys/block. Devices are
+// discovered on first use and rescanned on block uevents once attached to the health
+// loop. Once attached, stats are also sampled every DiskStatsSampler::kSampleInterval
+// from a timer on the loop, the boot device through |boot_sampler| and the others
+// through persistent fds, and getDiskStats reports the last samples without reading
+// sysfs. Entries are ordered with the boot device
+// first, then by name; the AIDL types carry no device name, so dump() lists the order.
+class StorageDevices {
+ public:
+  StorageDevices(std::string sys_block_dir, std::string boot_device,
+                 DiskStatsSampler *boot_sampler);
+
+  // Rescans on block device add/remove uevents received through |loop|, and starts the
+  // stats timer. The socket is filtered in the kernel to add/remove events.
+  void Attach(::android::hardware::health::HealthLoop *loop);
+
+  // Appends one entry per device from the last samples.
+  void GetDiskStats(std::vector<DiskStats> *stats);
+  // Appends one entry per USB disk; UFS health is reported separately. USB disks have
+  // no wear indicators, so their eol and lifetime fields are 0 (undefined).
+  void GetUsbStorageInfo(std::vector<StorageInfo> *infos);
+  void Dump(int fd);
+
+ private:
+  enum class Kind { kUfs, kUsb };
+
+  struct Device {
+    Kind kind;
+    std::unique_ptr<SysfsNode> stat;
+    std::string model;
+    DiskStats stats;
+  };
+
+  void ScanLocked();
+  void OnUevent();
+  void OnTimer();
+  // Reads the stat nodes of all devices but the boot device.
+  void Refresh();
+
+  const std::string sys_block_dir_;
+  const std::string boot_device_;
+  DiskStatsSampler *const boot_sampler_;
+  ::android::base::unique_fd uevent_fd_;
+  ::android::base::unique_fd timer_fd_;
+
+  std::mutex lock_;
+  bool scanned_ = false;
+  // Keyed by name with the boot device sorting first.
+  std::map<std::string, Device> devices_;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
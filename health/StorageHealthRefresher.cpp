@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "StorageHealthRefresher.h"
+
+#include <android-base/logging.h>
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace aidl::android::hardware::health::gs201 {
+
+using ::android::base::boot_clock;
+using namespace std::chrono_literals;
+
+// The background thread wakes this often to compare boot_clock against the interval;
+// its own sleep does not advance during suspend.
+constexpr auto kPollPeriod = 1h;
+
+StorageHealthRefresher::StorageHealthRefresher(const std::string &ufs_dir,
+                                               std::chrono::hours interval)
+    : version_node_(ufs_dir + "/device_descriptor/specification_version"),
+      eol_node_(ufs_dir + "/health_descriptor/eol_info"),
+      lifetime_a_node_(ufs_dir + "/health_descriptor/life_time_estimation_a"),
+      lifetime_b_node_(ufs_dir + "/health_descriptor/life_time_estimation_b"),
+      interval_(interval) {}
+
+StorageHealthRefresher::~StorageHealthRefresher() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+void StorageHealthRefresher::Start() {
+  if (thread_.joinable()) return;
+  thread_ = std::thread(&StorageHealthRefresher::Loop, this);
+}
+
+void StorageHealthRefresher::RefreshLocked() {
+  bool has_version;
+  uint16_t eol, lifetime_a, lifetime_b;
+
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    has_version = !version_.empty();
+    eol = eol_;
+    lifetime_a = lifetime_a_;
+    lifetime_b = lifetime_b_;
+  }
+
+  // The sysfs reads run without lock_ so that Get() is never blocked by them.
+  std::string version;
+  uint64_t value;
+  if (!has_version && version_node_.ReadInt(&value)) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "ufs %" PRIx64, value);
+    version = buf;
+    LOG(INFO) << "ufs: " << version << " detected";
+  }
+  eol_node_.ReadInt(&eol);
+  lifetime_a_node_.ReadInt(&lifetime_a);
+  lifetime_b_node_.ReadInt(&lifetime_b);
+  LOG(INFO) << "ufs: eol=" << eol << " lifetimeA=" << lifetime_a << " lifetimeB=" << lifetime_b;
+
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!version.empty()) version_ = version;
+  eol_ = eol;
+  lifetime_a_ = lifetime_a;
+  lifetime_b_ = lifetime_b;
+  last_refresh_ = boot_clock::now();
+}
+
+void StorageHealthRefresher::Loop() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!stop_) {
+    if (!last_refresh_ || boot_clock::now() - *last_refresh_ >= interval_) {
+      lock.unlock();
+      {
+        std::lock_guard<std::mutex> refresh_lock(refresh_lock_);
+        RefreshLocked();
+      }
+      lock.lock();
+    }
+    cv_.wait_for(lock, kPollPeriod, [this] { return stop_; });
+  }
+}
+
+void StorageHealthRefresher::Get(StorageInfo *info) {
+  if (!thread_.joinable()) {
+    std::lock_guard<std::mutex> refresh_lock(refresh_lock_);
+    bool due;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      due = !last_refresh_ || boot_clock::now() - *last_refresh_ >= interval_;
+    }
+    if (due) RefreshLocked();
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  info->version = version_;
+  info->eol = eol_;
+  info->lifetimeA = lifetime_a_;
+  info->lifetimeB = lifetime_b_;
+}
+
+}  // namespace aidl::android::hardware::health::gs201
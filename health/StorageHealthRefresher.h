@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/health/StorageInfo.h>
+#include <android-base/chrono_utils.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "SysfsReader.h"
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Keeps the last good UFS health descriptor values and refreshes them on a background
+// thread, so getStorageInfo never waits on a health descriptor query stuck behind UFS
+// traffic. The refresh interval is measured on boot_clock, which neither jumps with
+// wall clock changes nor stops during suspend. A failed read keeps the previous value.
+class StorageHealthRefresher {
+ public:
+  StorageHealthRefresher(const std::string &ufs_dir, std::chrono::hours interval);
+  ~StorageHealthRefresher();
+
+  void Start();
+  // Fills |info| from the cache. Refreshes inline when the background thread is not
+  // running and the interval has expired.
+  void Get(StorageInfo *info);
+
+ private:
+  void Loop();
+  // Reads the nodes into the cache. Requires refresh_lock_.
+  void RefreshLocked();
+
+  SysfsNode version_node_;
+  SysfsNode eol_node_;
+  SysfsNode lifetime_a_node_;
+  SysfsNode lifetime_b_node_;
+  const std::chrono::hours interval_;
+
+  // Serializes refreshes; never held by Get() while the background thread runs.
+  std::mutex refresh_lock_;
+  // Protects the cached values below.
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::string version_;
+  uint16_t eol_ = 0;
+  uint16_t lifetime_a_ = 0;
+  uint16_t lifetime_b_ = 0;
+  std::optional<::android::base::boot_clock::time_point> last_refresh_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "SysfsReader.h"
+
+#include <android-base/logging.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace aidl::android::hardware::health::gs201 {
+
+SysfsNode::SysfsNode(std::string path) : path_(std::move(path)) {}
+
+bool SysfsNode::SetError(int error) {
+  // Only log the transition into an error so a missing node does not spam the log.
+  if (error != 0 && error_ == 0) {
+    LOG(WARNING) << "Cannot read " << path_ << ": " << strerror(error);
+  }
+  error_ = error;
+  return error == 0;
+}
+
+ssize_t SysfsNode::Read(char *buf, size_t size) {
+  if (size == 0) {
+    SetError(EINVAL);
+    return -1;
+  }
+
+  if (fd_.get() < 0) {
+    fd_.reset(TEMP_FAILURE_RETRY(open(path_.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd_.get() < 0) {
+      SetError(errno);
+      return -1;
+    }
+  }
+
+  ssize_t len = TEMP_FAILURE_RETRY(pread(fd_.get(), buf, size - 1, 0));
+  if (len < 0) {
+    int error = errno;
+    // The node may have been removed and recreated; reopen it on the next read.
+    fd_.reset();
+    SetError(error);
+    return -1;
+  }
+
+  buf[len] = '\0';
+  SetError(0);
+  return len;
+}
+
+size_t SysfsNode::ReadInts(uint64_t *values, size_t count) {
+  char buf[256];
+  ssize_t len = Read(buf, sizeof(buf));
+  if (len < 0) return 0;
+
+  std::string_view str(buf, len);
+  size_t parsed = 0;
+  while (parsed < count) {
+    // Fields such as diskstats are always decimal, leading zeros included.
+    size_t pos = str.find_first_not_of(" \t\n");
+    if (pos == std::string_view::npos) break;
+    str.remove_prefix(pos);
+
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), values[parsed]);
+    if (ec != std::errc() || ptr == str.data()) break;
+    str.remove_prefix(ptr - str.data());
+    parsed++;
+  }
+
+  if (parsed < count) SetError(EINVAL);
+  return parsed;
+}
+
+}  // namespace aidl::android::hardware::health::gs201
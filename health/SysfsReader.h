@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace aidl::android::hardware::health::gs201 {
+
+// Parses an integer the way an iostream with an unset basefield does: a "0x" prefix
+// selects hex, a leading "0" selects octal, anything else is decimal. Leading
+// whitespace is skipped. Returns the number of characters consumed, 0 on error.
+template <typename T>
+size_t ParseSysfsInt(std::string_view str, T *value) {
+  static_assert(std::is_integral_v<T>);
+  size_t pos = str.find_first_not_of(" \t\n");
+  if (pos == std::string_view::npos) return 0;
+
+  bool negative = false;
+  if (std::is_signed_v<T> && (str[pos] == '-' || str[pos] == '+')) {
+    negative = str[pos] == '-';
+    pos++;
+  }
+
+  int base = 10;
+  if (str.size() > pos + 2 && str[pos] == '0' && (str[pos + 1] == 'x' || str[pos + 1] == 'X')) {
+    base = 16;
+    pos += 2;
+  } else if (str.size() > pos + 1 && str[pos] == '0') {
+    base = 8;
+  }
+
+  // Parse the magnitude unsigned so that the sign can be applied afterwards.
+  std::make_unsigned_t<T> magnitude;
+  const char *first = str.data() + pos;
+  auto [ptr, ec] = std::from_chars(first, str.data() + str.size(), magnitude, base);
+  if (ec != std::errc() || ptr == first) return 0;
+
+  *value = negative ? static_cast<T>(0 - magnitude) : static_cast<T>(magnitude);
+  return ptr - str.data();
+}
+
+// A sysfs node read through a persistent fd with pread() into a caller supplied buffer,
+// so periodic reads neither reopen the node nor allocate. The node is opened on first
+// use and reopened after a read error.
+class SysfsNode {
+ public:
+  explicit SysfsNode(std::string path);
+
+  // Reads the node into |buf| and NUL terminates it. Returns the number of bytes read,
+  // or -1 with error() set.
+  ssize_t Read(char *buf, size_t size);
+
+  // Reads a single integer. On failure |value| is left untouched.
+  template <typename T>
+  bool ReadInt(T *value) {
+    char buf[64];
+    ssize_t len = Read(buf, sizeof(buf));
+    if (len < 0) return false;
+    if (ParseSysfsInt(std::string_view(buf, len), value) == 0) return SetError(EINVAL);
+    return true;
+  }
+
+  // Reads up to |count| whitespace separated integers. Returns the number parsed.
+  size_t ReadInts(uint64_t *values, size_t count);
+
+  const std::string &path() const { return path_; }
+  // errno of the last failed read or parse, 0 if the last read succeeded.
+  int error() const { return error_; }
+
+ private:
+  bool SetError(int error);
+
+  const std::string path_;
+  ::android::base::unique_fd fd_;
+  int error_ = 0;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
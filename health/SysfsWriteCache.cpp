@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "android.hardware.health@2.1-impl-gs201"
+#include "SysfsWriteCache.h"
+
+#include <android-base/logging.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <cinttypes>
+
+namespace aidl::android::hardware::health::gs201 {
+
+CachedSysfsFile::CachedSysfsFile(std::string path) : path_(std::move(path)) {}
+
+bool CachedSysfsFile::Write(std::string_view value) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (valid_ && value == last_value_) {
+    suppressed_++;
+    return true;
+  }
+
+  if (fd_.get() < 0) {
+    fd_.reset(TEMP_FAILURE_RETRY(open(path_.c_str(), O_WRONLY | O_CLOEXEC)));
+  }
+  if (fd_.get() < 0 ||
+      TEMP_FAILURE_RETRY(pwrite(fd_.get(), value.data(), value.size(), 0)) !=
+          static_cast<ssize_t>(value.size())) {
+    PLOG(INFO) << "Unable to write " << value << " to " << path_;
+    // Reopen on the next write in case the node was recreated.
+    fd_.reset();
+    valid_ = false;
+    failures_++;
+    return false;
+  }
+
+  last_value_ = value;
+  valid_ = true;
+  writes_++;
+  return true;
+}
+
+void CachedSysfsFile::Invalidate() {
+  std::lock_guard<std::mutex> lock(lock_);
+  valid_ = false;
+}
+
+void CachedSysfsFile::Dump(int fd) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  dprintf(fd, "  %s: value=%s writes=%" PRIu64 " suppressed=%" PRIu64 " failures=%" PRIu64 "\n",
+          path_.c_str(), valid_ ? last_value_.c_str() : "(unknown)", writes_, suppressed_,
+          failures_);
+}
+
+}  // namespace aidl::android::hardware::health::gs201
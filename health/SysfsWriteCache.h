@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace aidl::android::hardware::health::gs201 {
+
+// A sysfs output written through a persistent fd that drops writes of the value it
+// last wrote successfully. Each write to a driver node can wake the driver and start a
+// bus transaction, so unchanged values are not rewritten. Invalidate() forces the next
+// write through, e.g. after the driver re-initialized its state.
+class CachedSysfsFile {
+ public:
+  explicit CachedSysfsFile(std::string path);
+
+  // Returns true if the node holds |value| afterwards.
+  bool Write(std::string_view value);
+  void Invalidate();
+  void Dump(int fd) const;
+
+ private:
+  const std::string path_;
+  // Dump() runs on a binder thread while writes come from the health loop.
+  mutable std::mutex lock_;
+  ::android::base::unique_fd fd_;
+  std::string last_value_;
+  bool valid_ = false;
+  uint64_t writes_ = 0;
+  uint64_t suppressed_ = 0;
+  uint64_t failures_ = 0;
+};
+
+}  // namespace aidl::android::hardware::health::gs201
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host-side decoder for the battery history ring written by the gs201 health HAL.
+//
+//   adb pull /data/vendor/health/battery_history
+//   battery_history_decode battery_history
+//
+// Prints the valid records in sequence order as CSV; torn or corrupt records are
+// counted and skipped.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <vector>
+
+#include "BatteryHistoryFormat.h"
+
+using aidl::android::hardware::health::gs201::BatteryHistoryChecksum;
+using aidl::android::hardware::health::gs201::BatteryHistoryHeader;
+using aidl::android::hardware::health::gs201::BatteryHistoryRecord;
+using aidl::android::hardware::health::gs201::kBatteryHistoryFileSize;
+using aidl::android::hardware::health::gs201::kBatteryHistoryMagic;
+using aidl::android::hardware::health::gs201::kBatteryHistoryPageSize;
+using aidl::android::hardware::health::gs201::kBatteryHistoryRecordCount;
+using aidl::android::hardware::health::gs201::kBatteryHistoryRecordMagic;
+using aidl::android::hardware::health::gs201::kBatteryHistoryVersion;
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <battery_history>\n", argv[0]);
+    return 1;
+  }
+
+  FILE *file = fopen(argv[1], "rb");
+  if (file == nullptr) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> data(kBatteryHistoryFileSize);
+  size_t len = fread(data.data(), 1, data.size(), file);
+  fclose(file);
+  if (len != data.size()) {
+    fprintf(stderr, "%s: expected %zu bytes, read %zu\n", argv[1], data.size(), len);
+    return 1;
+  }
+
+  BatteryHistoryHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != kBatteryHistoryMagic || header.version != kBatteryHistoryVersion ||
+      header.record_size != sizeof(BatteryHistoryRecord) ||
+      header.record_count != kBatteryHistoryRecordCount) {
+    fprintf(stderr, "%s: not a version %u battery history file\n", argv[1],
+            kBatteryHistoryVersion);
+    return 1;
+  }
+  if (header.crc != BatteryHistoryChecksum(header))
+    fprintf(stderr, "warning: header checksum mismatch\n");
+
+  std::vector<BatteryHistoryRecord> records;
+  size_t empty = 0, corrupt = 0;
+  for (size_t slot = 0; slot < kBatteryHistoryRecordCount; slot++) {
+    BatteryHistoryRecord record;
+    memcpy(&record, data.data() + kBatteryHistoryPageSize + slot * sizeof(record), sizeof(record));
+    if (record.magic == 0 && record.crc == 0) {
+      empty++;
+    } else if (record.magic != kBatteryHistoryRecordMagic ||
+               record.crc != BatteryHistoryChecksum(record)) {
+      corrupt++;
+    } else {
+      records.push_back(record);
+    }
+  }
+  std::sort(records.begin(), records.end(),
+            [](const auto &a, const auto &b) { return a.seq < b.seq; });
+
+  printf("# boot_count=%u records=%zu empty=%zu corrupt=%zu\n", header.boot_count,
+         records.size(), empty, corrupt);
+  printf("seq,boot,boot_time_ms,real_time_ms,status,level,current_ua,voltage_uv,ocv_uv,"
+         "resistance,temperature_decic\n");
+  for (const auto &r : records) {
+    printf("%" PRIu64 ",%u,%" PRId64 ",%" PRId64 ",%d,%d,%d,%d,%d,%d,%d\n", r.seq, r.boot_count,
+           r.boot_time_ms, r.real_time_ms, r.status, r.level, r.current_ua, r.voltage_uv,
+           r.ocv_uv, r.resistance, r.temperature_decic);
+  }
+  return 0;
+}
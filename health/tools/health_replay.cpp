@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host-side replay harness for the gs201 health HAL update path.
+//
+//   health_replay [--realtime] [--csv <out.csv>] [<session>]
+//
+// Builds a fake sysfs and /data tree in a temporary directory, points the HAL
+// components at it through GS201_HEALTH_ROOT and replays a charge session: the given
+// file, or a built-in synthetic one. Every step writes power_supply attributes and
+// then runs the work the HAL does for its event. Per step it measures the wall time,
+// the read and write syscalls (from /proc/self/io) and the heap allocations, and it
+// prints a summary per event type.
+//
+// Session files hold one step per line:
+//
+//   <ms> <event> [<supply>/<attribute>=<value> ...]
+//
+// <ms> is the time since the start of the session. <event> is "uevent" or "chore" for
+// a battery update, or "diskstats" for a getDiskStats call. The attributes are written
+// under sys/class/power_supply before the event runs. Lines starting with '#' are
+// ignored.
+//
+// BatteryMonitor and libpixelhealth only build for the device, so the update replayed
+// here reads the battery nodes and runs the gs201 part of it, BoardUpdate, which the
+// service runs as well: appending the battery history record and writing the wireless
+// charger capacity. Steps run back to back
+// unless --realtime is given; then the recorded gaps are slept so that the time based
+// rate limits behave as on a device. The tree is left in place afterwards, so the
+// battery history can be inspected with battery_history_decode.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <aidl/android/hardware/health/HealthInfo.h>
+#include <android-base/file.h>
+#include <android-base/strings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "BoardUpdate.h"
+#include "DiskStatsSampler.h"
+#include "HealthPaths.h"
+#include "HealthUpdateStats.h"
+#include "SysfsReader.h"
+
+using aidl::android::hardware::health::BatteryStatus;
+using aidl::android::hardware::health::DiskStats;
+using aidl::android::hardware::health::HealthInfo;
+using aidl::android::hardware::health::gs201::BoardUpdate;
+using aidl::android::hardware::health::gs201::DiskStatsSampler;
+using aidl::android::hardware::health::gs201::HealthUpdateStats;
+using aidl::android::hardware::health::gs201::kHealthRootEnv;
+using aidl::android::hardware::health::gs201::RootedPath;
+using aidl::android::hardware::health::gs201::SysfsNode;
+
+namespace {
+
+// Heap allocations made while counting is enabled.
+std::atomic<bool> counting_allocs{false};
+std::atomic<uint64_t> alloc_count{0};
+std::atomic<uint64_t> alloc_bytes{0};
+
+}  // namespace
+
+void *operator new(size_t size) {
+  if (counting_allocs.load(std::memory_order_relaxed)) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  void *ptr = malloc(size ? size : 1);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+namespace {
+
+#define PSY_DIR "/sys/class/power_supply"
+#define FG_DIR PSY_DIR "/battery"
+#define WLC_DIR PSY_DIR "/wireless"
+
+// Initial contents of the fake tree, relative to the root.
+const std::pair<const char *, const char *> kFakeTree[] = {
+    {FG_DIR "/present", "1"},
+    {FG_DIR "/capacity", "50"},
+    {FG_DIR "/status", "Discharging"},
+    {FG_DIR "/current_now", "-300000"},
+    {FG_DIR "/voltage_now", "3900000"},
+    {FG_DIR "/voltage_ocv", "3950000"},
+    {FG_DIR "/resistance", "120"},
+    {FG_DIR "/temp", "250"},
+    {PSY_DIR "/usb/online", "0"},
+    {WLC_DIR "/present", "1"},
+    {WLC_DIR "/online", "0"},
+    {WLC_DIR "/capacity", "0"},
+    {"/sys/block/sda/stat", "1000 0 8000 100 500 0 4000 50 0 150 150 0 0 0 0 0 0"},
+};
+
+enum class Event { kUpdate, kDiskStats };
+
+struct Step {
+  int64_t ms;
+  Event event;
+  std::string name;
+  // Attribute path relative to the power_supply directory, and its value.
+  std::vector<std::pair<std::string, std::string>> writes;
+};
+
+struct Sample {
+  const Step *step;
+  int64_t latency_ns;
+  int64_t read_syscalls;
+  int64_t write_syscalls;
+  uint64_t allocs;
+  uint64_t alloc_bytes;
+};
+
+bool WriteNode(const std::string &path, const std::string &value) {
+  if (!android::base::WriteStringToFile(value, path)) {
+    fprintf(stderr, "Unable to write %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool MakeDirs(const std::string &path) {
+  for (size_t pos = 1; pos != std::string::npos; pos = path.find('/', pos + 1)) {
+    std::string dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+      fprintf(stderr, "Unable to create %s: %s\n", dir.c_str(), strerror(errno));
+      return false;
+    }
+  }
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+bool BuildFakeTree(const std::string &root) {
+  for (const auto &[path, value] : kFakeTree) {
+    std::string full = root + path;
+    if (!MakeDirs(full.substr(0, full.rfind('/'))) || !WriteNode(full, value)) return false;
+  }
+  return MakeDirs(root + "/data/vendor/health");
+}
+
+bool ParseSession(const std::string &path, std::vector<Step> *steps) {
+  std::string content;
+  if (!android::base::ReadFileToString(path, &content)) {
+    fprintf(stderr, "Unable to read %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  int line_number = 0;
+  for (const auto &line : android::base::Split(content, "\n")) {
+    line_number++;
+    std::string trimmed = android::base::Trim(line);
+    if (trimmed.empty() || trimmed[0] == '#') continue;
+
+    std::vector<std::string> fields = android::base::Tokenize(trimmed, " \t");
+    Step step;
+    char *end;
+    step.ms = strtoll(fields[0].c_str(), &end, 10);
+    if (fields.size() < 2 || *end != '\0') {
+      fprintf(stderr, "%s:%d: expected <ms> <event>\n", path.c_str(), line_number);
+      return false;
+    }
+    step.name = fields[1];
+    if (step.name == "uevent" || step.name == "chore") {
+      step.event = Event::kUpdate;
+    } else if (step.name == "diskstats") {
+      step.event = Event::kDiskStats;
+    } else {
+      fprintf(stderr, "%s:%d: unknown event %s\n", path.c_str(), line_number,
+              step.name.c_str());
+      return false;
+    }
+    for (size_t i = 2; i < fields.size(); i++) {
+      size_t eq = fields[i].find('=');
+      if (eq == std::string::npos || fields[i].find("..") != std::string::npos) {
+        fprintf(stderr, "%s:%d: bad attribute %s\n", path.c_str(), line_number,
+                fields[i].c_str());
+        return false;
+      }
+      step.writes.emplace_back(fields[i].substr(0, eq), fields[i].substr(eq + 1));
+    }
+    steps->push_back(std::move(step));
+  }
+  std::stable_sort(steps->begin(), steps->end(),
+                   [](const Step &a, const Step &b) { return a.ms < b.ms; });
+  return true;
+}
+
+// Plugs in at 15% and charges to full over about 90 minutes. The charger emits a
+// burst of three uevents on every level change, chores run every minute and the
+// storage stats are polled every ten minutes. The pad is swapped for a cable halfway.
+std::vector<Step> SyntheticSession() {
+  constexpr int64_t kLevelStepMs = 63000;
+  std::vector<Step> steps;
+  steps.push_back({0, Event::kUpdate, "uevent",
+                   {{"usb/online", "1"}, {"battery/status", "Charging"},
+                    {"battery/capacity", "15"}, {"battery/current_now", "2000000"}}});
+  int64_t end_ms = 0;
+  for (int level = 16; level <= 100; level++) {
+    int64_t ms = (level - 15) * kLevelStepMs;
+    std::string current = std::to_string(3000000 - level * 25000);
+    steps.push_back({ms, Event::kUpdate, "uevent",
+                     {{"battery/capacity", std::to_string(level)},
+                      {"battery/current_now", current}}});
+    steps.push_back({ms + 40, Event::kUpdate, "uevent", {{"battery/voltage_now", "4100000"}}});
+    steps.push_back({ms + 80, Event::kUpdate, "uevent", {{"battery/temp", "310"}}});
+    if (level == 50) {
+      steps.push_back({ms + 500, Event::kUpdate, "uevent",
+                       {{"usb/online", "0"}, {"wireless/online", "1"}}});
+    }
+    end_ms = ms;
+  }
+  steps.push_back({end_ms + 1000, Event::kUpdate, "uevent", {{"battery/status", "Full"}}});
+  for (int64_t ms = 60000; ms < end_ms; ms += 60000)
+    steps.push_back({ms, Event::kUpdate, "chore", {}});
+  for (int64_t ms = 600000; ms < end_ms; ms += 600000)
+    steps.push_back({ms, Event::kDiskStats, "diskstats", {}});
+  steps.push_back({end_ms + 60000, Event::kUpdate, "uevent",
+                   {{"wireless/online", "0"}, {"battery/status", "Discharging"},
+                    {"battery/current_now", "-300000"}}});
+  std::stable_sort(steps.begin(), steps.end(),
+                   [](const Step &a, const Step &b) { return a.ms < b.ms; });
+  return steps;
+}
+
+// The gs201 components the HAL runs per update, set up with the same paths.
+class ReplayedHal {
+ public:
+  ReplayedHal()
+      : update_stats_(std::chrono::milliseconds{100}),
+        board_(RootedPath("/data/vendor/health/battery_history"), RootedPath(FG_DIR),
+               RootedPath(WLC_DIR "/capacity"), &update_stats_),
+        disk_stats_(RootedPath("/sys/block/sda/stat")),
+        capacity_(RootedPath(FG_DIR "/capacity")),
+        status_(RootedPath(FG_DIR "/status")),
+        current_(RootedPath(FG_DIR "/current_now")),
+        temp_(RootedPath(FG_DIR "/temp")),
+        usb_online_(RootedPath(PSY_DIR "/usb/online")),
+        wlc_online_(RootedPath(WLC_DIR "/online")) {
+    board_.set_wlc_updates(true);
+  }
+
+  void Update() {
+    HealthInfo info;
+    capacity_.ReadInt(&info.batteryLevel);
+    current_.ReadInt(&info.batteryCurrentMicroamps);
+    temp_.ReadInt(&info.batteryTemperatureTenthsCelsius);
+    int online = 0;
+    if (usb_online_.ReadInt(&online)) info.chargerUsbOnline = online != 0;
+    if (wlc_online_.ReadInt(&online)) info.chargerWirelessOnline = online != 0;
+    char status[32];
+    if (status_.Read(status, sizeof(status)) > 0) info.batteryStatus = ParseStatus(status);
+
+    HealthUpdateStats::ScopedStage total(&update_stats_, HealthUpdateStats::kTotal);
+    board_.Update(info, true);
+  }
+
+  // The service samples on a loop timer; without a loop, sample on each request.
+  void GetDiskStats() {
+    disk_stats_.Tick();
+    DiskStats stats;
+    disk_stats_.Latest(&stats);
+  }
+
+  void Dump(int fd) {
+    board_.Dump(fd);
+    update_stats_.Dump(fd);
+    disk_stats_.Dump(fd);
+  }
+
+ private:
+  static BatteryStatus ParseStatus(std::string_view status) {
+    if (android::base::StartsWith(status, "Charging")) return BatteryStatus::CHARGING;
+    if (android::base::StartsWith(status, "Discharging")) return BatteryStatus::DISCHARGING;
+    if (android::base::StartsWith(status, "Not charging")) return BatteryStatus::NOT_CHARGING;
+    if (android::base::StartsWith(status, "Full")) return BatteryStatus::FULL;
+    return BatteryStatus::UNKNOWN;
+  }
+
+  HealthUpdateStats update_stats_;
+  BoardUpdate board_;
+  DiskStatsSampler disk_stats_;
+  SysfsNode capacity_;
+  SysfsNode status_;
+  SysfsNode current_;
+  SysfsNode temp_;
+  SysfsNode usb_online_;
+  SysfsNode wlc_online_;
+};
+
+// Reads the syscr and syscw counters of /proc/self/io through a persistent fd, so
+// each snapshot costs a single read syscall.
+class SyscallCounter {
+ public:
+  SyscallCounter() : fd_(open("/proc/self/io", O_RDONLY | O_CLOEXEC)) {
+    int64_t read_before, write_before, read_after, write_after;
+    if (Snapshot(&read_before, &write_before) && Snapshot(&read_after, &write_after)) {
+      read_overhead_ = read_after - read_before;
+      write_overhead_ = write_after - write_before;
+    }
+  }
+
+  ~SyscallCounter() {
+    if (fd_ != -1) close(fd_);
+  }
+
+  bool Snapshot(int64_t *reads, int64_t *writes) {
+    char buf[512];
+    ssize_t len = fd_ == -1 ? -1 : pread(fd_, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) return false;
+    buf[len] = '\0';
+    const char *syscr = strstr(buf, "syscr: ");
+    const char *syscw = strstr(buf, "syscw: ");
+    if (syscr == nullptr || syscw == nullptr) return false;
+    *reads = strtoll(syscr + strlen("syscr: "), nullptr, 10);
+    *writes = strtoll(syscw + strlen("syscw: "), nullptr, 10);
+    return true;
+  }
+
+  int64_t read_overhead() const { return read_overhead_; }
+  int64_t write_overhead() const { return write_overhead_; }
+
+ private:
+  int fd_;
+  int64_t read_overhead_ = 0;
+  int64_t write_overhead_ = 0;
+};
+
+int64_t Percentile(std::vector<int64_t> values, double fraction) {
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, static_cast<size_t>(values.size() * fraction));
+  return values[index];
+}
+
+void PrintSummary(const std::vector<Sample> &samples, const char *name, bool have_syscalls) {
+  std::vector<int64_t> latencies;
+  int64_t reads = 0, writes = 0;
+  uint64_t allocs = 0, bytes = 0;
+  for (const auto &sample : samples) {
+    if (sample.step->name != name) continue;
+    latencies.push_back(sample.latency_ns);
+    reads += sample.read_syscalls;
+    writes += sample.write_syscalls;
+    allocs += sample.allocs;
+    bytes += sample.alloc_bytes;
+  }
+  if (latencies.empty()) return;
+  double n = latencies.size();
+  printf("%-10s %6zu  us p50 %7.1f p90 %7.1f p99 %7.1f max %8.1f", name, latencies.size(),
+         Percentile(latencies, 0.5) / 1e3, Percentile(latencies, 0.9) / 1e3,
+         Percentile(latencies, 0.99) / 1e3, Percentile(latencies, 1.0) / 1e3);
+  if (have_syscalls)
+    printf("  reads %5.2f writes %5.2f", reads / n, writes / n);
+  else
+    printf("  syscalls n/a");
+  printf("  allocs %5.2f (%.0f bytes)\n", allocs / n, bytes / n);
+}
+
+void Usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [--realtime] [--csv <out.csv>] [<session>]\n", argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  bool realtime = false;
+  std::string csv_path, session_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--realtime") {
+      realtime = true;
+    } else if (arg == "--csv" && i + 1 < argc) {
+      csv_path = argv[++i];
+    } else if (arg[0] != '-' && session_path.empty()) {
+      session_path = arg;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<Step> steps;
+  if (session_path.empty()) {
+    steps = SyntheticSession();
+  } else if (!ParseSession(session_path, &steps)) {
+    return 1;
+  }
+
+  char root_template[] = "/tmp/health_replay.XXXXXX";
+  if (mkdtemp(root_template) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string root = root_template;
+  // RootedPath() reads this once, so it has to be set before the HAL is set up.
+  setenv(kHealthRootEnv, root.c_str(), 1);
+  if (!BuildFakeTree(root)) return 1;
+  printf("Replaying %zu steps against %s\n", steps.size(), root.c_str());
+
+  ReplayedHal hal;
+  SyscallCounter syscalls;
+  std::vector<Sample> samples;
+  samples.reserve(steps.size());
+  bool have_syscalls = true;
+  auto start = std::chrono::steady_clock::now();
+
+  for (const auto &step : steps) {
+    if (realtime) std::this_thread::sleep_until(start + std::chrono::milliseconds(step.ms));
+    for (const auto &[attribute, value] : step.writes) {
+      if (!WriteNode(root + PSY_DIR "/" + attribute, value)) return 1;
+    }
+
+    int64_t reads_before = 0, writes_before = 0, reads_after = 0, writes_after = 0;
+    have_syscalls &= syscalls.Snapshot(&reads_before, &writes_before);
+    alloc_count = 0;
+    alloc_bytes = 0;
+    counting_allocs = true;
+    auto step_start = std::chrono::steady_clock::now();
+
+    if (step.event == Event::kUpdate)
+      hal.Update();
+    else
+      hal.GetDiskStats();
+
+    auto step_end = std::chrono::steady_clock::now();
+    counting_allocs = false;
+    have_syscalls &= syscalls.Snapshot(&reads_after, &writes_after);
+
+    samples.push_back(
+        {&step, std::chrono::duration_cast<std::chrono::nanoseconds>(step_end - step_start)
+                        .count(),
+         reads_after - reads_before - syscalls.read_overhead(),
+         writes_after - writes_before - syscalls.write_overhead(), alloc_count.load(),
+         alloc_bytes.load()});
+  }
+
+  printf("%-10s %6s\n", "event", "steps");
+  PrintSummary(samples, "uevent", have_syscalls);
+  PrintSummary(samples, "chore", have_syscalls);
+  PrintSummary(samples, "diskstats", have_syscalls);
+  printf("\n");
+  fflush(stdout);
+  hal.Dump(STDOUT_FILENO);
+
+  if (!csv_path.empty()) {
+    FILE *csv = fopen(csv_path.c_str(), "w");
+    if (csv == nullptr) {
+      perror(csv_path.c_str());
+      return 1;
+    }
+    fprintf(csv, "ms,event,latency_us,read_syscalls,write_syscalls,allocs,alloc_bytes\n");
+    for (const auto &sample : samples) {
+      fprintf(csv, "%" PRId64 ",%s,%.1f,%" PRId64 ",%" PRId64 ",%" PRIu64 ",%" PRIu64 "\n",
+              sample.step->ms, sample.step->name.c_str(), sample.latency_ns / 1e3,
+              sample.read_syscalls, sample.write_syscalls, sample.allocs, sample.alloc_bytes);
+    }
+    fclose(csv);
+  }
+  return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares SysfsNode with the ifstream reads it replaced in the health HAL.
+//
+//   sysfs_read_bench [--iterations <n>] [<node> ...]
+//
+// The ifstream path is the one Health.cpp used before SysfsNode: an ifstream opened
+// per value with the basefield unset, and one stream extraction per disk stats field.
+// Each case is read <n> times (10000 by default) both ways. The cases are a UFS health
+// descriptor value, the UFS specification version and a block device stat line, written
+// to a temporary directory, plus one integer read of every <node> given, e.g. real
+// sysfs nodes when run on a device. Per case it prints the time per read and the heap
+// allocations per read of both paths, and checks that they parse the same values.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "SysfsReader.h"
+
+using aidl::android::hardware::health::gs201::SysfsNode;
+
+namespace {
+
+// Heap allocations made while counting is enabled.
+std::atomic<bool> counting_allocs{false};
+std::atomic<uint64_t> alloc_count{0};
+
+}  // namespace
+
+void *operator new(size_t size) {
+  if (counting_allocs.load(std::memory_order_relaxed))
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = malloc(size ? size : 1);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+namespace {
+
+constexpr size_t kStatFields = 11;
+
+// Test files, relative to the temporary directory.
+const std::pair<const char *, const char *> kFakeNodes[] = {
+    {"life_time_estimation_a", "0x01\n"},
+    {"specification_version", "0x0310\n"},
+    {"stat", "  183921        0  9216534    86417    72634    41083  3187216   127933        0"
+             "   121900   214350        0        0        0        0        0        0\n"},
+};
+
+struct Result {
+  double ns_per_read;
+  double allocs_per_read;
+};
+
+// Runs |read| |iterations| times, keeping the best of a few rounds to filter out
+// scheduling noise.
+Result Measure(int iterations, const std::function<void()> &read) {
+  constexpr int kRounds = 5;
+  Result best = {1e18, 0};
+  for (int round = 0; round < kRounds; round++) {
+    alloc_count = 0;
+    counting_allocs = true;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) read();
+    auto end = std::chrono::steady_clock::now();
+    counting_allocs = false;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    if (ns < best.ns_per_read) best = {ns, static_cast<double>(alloc_count) / iterations};
+  }
+  return best;
+}
+
+// As read_value_from_file() in Health.cpp did.
+template <typename T>
+void IfstreamReadInt(const std::string &path, T *value) {
+  std::ifstream stream(path);
+  stream.unsetf(std::ios_base::basefield);
+  stream >> *value;
+}
+
+// As private_get_disk_stats() in Health.cpp did.
+void IfstreamReadStats(const std::string &path, uint64_t *fields) {
+  std::ifstream stream(path);
+  for (size_t i = 0; i < kStatFields; i++) stream >> fields[i];
+}
+
+void PrintResult(const char *method, const Result &result) {
+  printf("  %-8s %9.0f ns/read %6.2f allocs/read\n", method, result.ns_per_read,
+         result.allocs_per_read);
+}
+
+// Returns false if the two paths parse different values.
+bool BenchInt(const std::string &path, int iterations) {
+  uint64_t stream_value = 0, node_value = 0;
+  IfstreamReadInt(path, &stream_value);
+  SysfsNode node(path);
+  if (!node.ReadInt(&node_value)) {
+    fprintf(stderr, "Unable to read %s: %s\n", path.c_str(), strerror(node.error()));
+    return false;
+  }
+
+  printf("%s\n", path.c_str());
+  PrintResult("ifstream", Measure(iterations, [&] { IfstreamReadInt(path, &stream_value); }));
+  PrintResult("pread", Measure(iterations, [&] { node.ReadInt(&node_value); }));
+  if (stream_value == node_value) return true;
+  fprintf(stderr, "%s: ifstream read %" PRIu64 ", pread read %" PRIu64 "\n", path.c_str(),
+          stream_value, node_value);
+  return false;
+}
+
+bool BenchStats(const std::string &path, int iterations) {
+  uint64_t stream_fields[kStatFields] = {}, node_fields[kStatFields] = {};
+  SysfsNode node(path);
+
+  printf("%s\n", path.c_str());
+  PrintResult("ifstream", Measure(iterations, [&] { IfstreamReadStats(path, stream_fields); }));
+  PrintResult("pread", Measure(iterations, [&] { node.ReadInts(node_fields, kStatFields); }));
+  if (memcmp(stream_fields, node_fields, sizeof(stream_fields)) == 0) return true;
+  fprintf(stderr, "%s: ifstream and pread parsed different fields\n", path.c_str());
+  return false;
+}
+
+void Usage(const char *argv0) {
+  fprintf(stderr, "usage: %s [--iterations <n>] [<node> ...]\n", argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int iterations = 10000;
+  std::vector<std::string> nodes;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--iterations" && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (arg[0] != '-') {
+      nodes.push_back(arg);
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  if (iterations <= 0) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  char dir_template[] = "/tmp/sysfs_read_bench.XXXXXX";
+  if (mkdtemp(dir_template) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string dir = dir_template;
+  for (const auto &[name, value] : kFakeNodes) {
+    if (!android::base::WriteStringToFile(value, dir + "/" + name)) {
+      fprintf(stderr, "Unable to write %s/%s: %s\n", dir.c_str(), name, strerror(errno));
+      return 1;
+    }
+  }
+
+  bool same = BenchInt(dir + "/life_time_estimation_a", iterations);
+  same &= BenchInt(dir + "/specification_version", iterations);
+  same &= BenchStats(dir + "/stat", iterations);
+  for (const auto &node : nodes) same &= BenchInt(node, iterations);
+
+  for (const auto &[name, value] : kFakeNodes) unlink((dir + "/" + name).c_str());
+  rmdir(dir.c_str());
+  return same ? 0 : 1;
+}
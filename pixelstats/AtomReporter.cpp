@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "AtomReporter.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android/binder_status.h>
+#include <pixelstats/StatsHelper.h>
+
+#include <cinttypes>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::StringPrintf;
+
+namespace {
+
+// Spooled atoms are read back and consumed in batches of this size.
+constexpr size_t kDrainBatch = 32;
+
+// Only transport failures, such as statsd restarting, are worth retrying; an atom
+// that statsd rejected would be rejected again.
+bool isTransportError(const ndk::ScopedAStatus &status) {
+    return status.getExceptionCode() == EX_TRANSACTION_FAILED;
+}
+
+}  // namespace
+
+AtomReporter::AtomReporter(AtomSpool *spool) : spool_(spool) {}
+
+void AtomReporter::report(std::vector<VendorAtom> &&atoms) {
+    if (atoms.empty())
+        return;
+
+    const std::shared_ptr<IStats> stats_client = getStatsService();
+    if (!stats_client) {
+        LOG(ERROR) << "Unable to get AIDL Stats service";
+        spool(atoms.begin(), atoms.end());
+        return;
+    }
+    // Keep the spooled atoms ahead of these ones.
+    if (!drain(stats_client.get())) {
+        spool(atoms.begin(), atoms.end());
+        return;
+    }
+
+    for (auto it = atoms.begin(); it != atoms.end(); ++it) {
+        const ndk::ScopedAStatus ret = stats_client->reportVendorAtom(*it);
+        if (ret.isOk()) {
+            reported_++;
+        } else if (!isTransportError(ret)) {
+            LOG(ERROR) << "Atom " << it->atomId << " rejected: " << ret.getExceptionCode();
+            dropped_++;
+        } else {
+            LOG(ERROR) << "Unable to report atom " << it->atomId;
+            spool(it, atoms.end());
+            return;
+        }
+    }
+}
+
+bool AtomReporter::drain(IStats *stats) {
+    if (spool_ == nullptr)
+        return true;
+
+    bool ok = true;
+    std::vector<VendorAtom> batch;
+    while (ok) {
+        batch.clear();
+        if (spool_->peek(kDrainBatch, &batch) == 0)
+            break;
+        size_t consumed = 0;
+        for (const auto &atom : batch) {
+            const ndk::ScopedAStatus ret = stats->reportVendorAtom(atom);
+            if (ret.isOk()) {
+                drained_++;
+            } else if (!isTransportError(ret)) {
+                dropped_++;
+            } else {
+                ok = false;
+                break;
+            }
+            consumed++;
+        }
+        spool_->consume(consumed);
+    }
+    spool_->flush();
+    return ok;
+}
+
+void AtomReporter::spool(std::vector<VendorAtom>::const_iterator begin,
+                         std::vector<VendorAtom>::const_iterator end) {
+    for (auto it = begin; it != end; ++it) {
+        if (spool_ != nullptr && spool_->append(*it)) {
+            spooled_++;
+        } else {
+            dropped_++;
+        }
+    }
+    if (spool_ != nullptr)
+        spool_->flush();
+}
+
+std::string AtomReporter::dump() const {
+    std::string dump = StringPrintf("Atom reporter: %" PRIu64 " reported, %" PRIu64
+                                    " spooled, %" PRIu64 " drained, %" PRIu64 " dropped\n",
+                                    reported_, spooled_, drained_, dropped_);
+    if (spool_ != nullptr)
+        dump += spool_->dump();
+    return dump;
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
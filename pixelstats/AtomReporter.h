@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMREPORTER_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMREPORTER_H
+
+#include <aidl/android/frameworks/stats/IStats.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AtomSpool.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using aidl::android::frameworks::stats::IStats;
+using aidl::android::frameworks::stats::VendorAtom;
+using aidl::android::frameworks::stats::VendorAtomValue;
+
+/**
+ * Reports the atoms produced by one collection pass of the gs201 metric groups to
+ * IStats. Atoms that cannot be delivered go to the spool, if there is one, and are
+ * delivered from there ahead of newer atoms once IStats accepts them again. The
+ * SysfsCollector and UeventListener report through libpixelstats and bypass both.
+ */
+class AtomReporter {
+  public:
+    explicit AtomReporter(AtomSpool *spool = nullptr);
+
+    // Delivers the spooled atoms, then |atoms|.
+    void report(std::vector<VendorAtom> &&atoms);
+    std::string dump() const;
+
+  private:
+    bool drain(IStats *stats);
+    void spool(std::vector<VendorAtom>::const_iterator begin,
+               std::vector<VendorAtom>::const_iterator end);
+
+    AtomSpool *const spool_;
+    uint64_t reported_ = 0;
+    uint64_t spooled_ = 0;
+    uint64_t drained_ = 0;
+    uint64_t dropped_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMREPORTER_H
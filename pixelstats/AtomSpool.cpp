@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "AtomSpool.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using aidl::android::frameworks::stats::VendorAtomValue;
+using android::base::StringPrintf;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Retry interval while /data/vendor/pixelstats is not available.
+constexpr auto kReopenInterval = 60s;
+
+template <typename T>
+void put(std::vector<uint8_t> *out, T value) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+    out->insert(out->end(), p, p + sizeof(value));
+}
+
+bool putString(std::vector<uint8_t> *out, const std::string &str) {
+    if (str.size() > UINT16_MAX)
+        return false;
+    put<uint16_t>(out, str.size());
+    out->insert(out->end(), str.begin(), str.end());
+    return true;
+}
+
+bool encodeAtom(const VendorAtom &atom, std::vector<uint8_t> *out) {
+    if (atom.values.size() > UINT16_MAX || !putString(out, atom.reverseDomainName))
+        return false;
+    put<int32_t>(out, atom.atomId);
+    put<uint16_t>(out, atom.values.size());
+    for (const auto &value : atom.values) {
+        switch (value.getTag()) {
+            case VendorAtomValue::intValue:
+                put<uint8_t>(out, kAtomSpoolInt);
+                put<int32_t>(out, value.get<VendorAtomValue::intValue>());
+                break;
+            case VendorAtomValue::longValue:
+                put<uint8_t>(out, kAtomSpoolLong);
+                put<int64_t>(out, value.get<VendorAtomValue::longValue>());
+                break;
+            case VendorAtomValue::floatValue:
+                put<uint8_t>(out, kAtomSpoolFloat);
+                put<float>(out, value.get<VendorAtomValue::floatValue>());
+                break;
+            case VendorAtomValue::boolValue:
+                put<uint8_t>(out, kAtomSpoolBool);
+                put<uint8_t>(out, value.get<VendorAtomValue::boolValue>() ? 1 : 0);
+                break;
+            case VendorAtomValue::stringValue:
+                put<uint8_t>(out, kAtomSpoolString);
+                if (!putString(out, value.get<VendorAtomValue::stringValue>()))
+                    return false;
+                break;
+            default:
+                // Repeated and byte array fields are not used by the gs201 atoms.
+                return false;
+        }
+    }
+    return out->size() <= kAtomSpoolMaxPayload;
+}
+
+class Reader {
+  public:
+    explicit Reader(const std::vector<uint8_t> &data) : data_(data) {}
+
+    template <typename T>
+    bool get(T *value) {
+        if (data_.size() - pos_ < sizeof(T))
+            return false;
+        memcpy(value, data_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool getString(std::string *str) {
+        uint16_t len;
+        if (!get(&len) || data_.size() - pos_ < len)
+            return false;
+        str->assign(reinterpret_cast<const char *>(data_.data() + pos_), len);
+        pos_ += len;
+        return true;
+    }
+
+    bool done() const { return pos_ == data_.size(); }
+
+  private:
+    const std::vector<uint8_t> &data_;
+    size_t pos_ = 0;
+};
+
+bool decodeAtom(const std::vector<uint8_t> &payload, VendorAtom *atom) {
+    Reader reader(payload);
+    uint16_t count;
+    if (!reader.getString(&atom->reverseDomainName) || !reader.get(&atom->atomId) ||
+        !reader.get(&count))
+        return false;
+
+    atom->values.clear();
+    for (uint16_t i = 0; i < count; i++) {
+        uint8_t tag;
+        if (!reader.get(&tag))
+            return false;
+        switch (tag) {
+            case kAtomSpoolInt: {
+                int32_t v;
+                if (!reader.get(&v))
+                    return false;
+                atom->values.push_back(VendorAtomValue::make<VendorAtomValue::intValue>(v));
+                break;
+            }
+            case kAtomSpoolLong: {
+                int64_t v;
+                if (!reader.get(&v))
+                    return false;
+                atom->values.push_back(VendorAtomValue::make<VendorAtomValue::longValue>(v));
+                break;
+            }
+            case kAtomSpoolFloat: {
+                float v;
+                if (!reader.get(&v))
+                    return false;
+                atom->values.push_back(VendorAtomValue::make<VendorAtomValue::floatValue>(v));
+                break;
+            }
+            case kAtomSpoolBool: {
+                uint8_t v;
+                if (!reader.get(&v))
+                    return false;
+                atom->values.push_back(
+                        VendorAtomValue::make<VendorAtomValue::boolValue>(v != 0));
+                break;
+            }
+            case kAtomSpoolString: {
+                std::string v;
+                if (!reader.getString(&v))
+                    return false;
+                atom->values.push_back(
+                        VendorAtomValue::make<VendorAtomValue::stringValue>(std::move(v)));
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return reader.done();
+}
+
+}  // namespace
+
+AtomSpool::AtomSpool(std::string path) : path_(std::move(path)) {}
+
+AtomSpool::~AtomSpool() {
+    if (map_ != nullptr)
+        munmap(map_, kAtomSpoolFileSize);
+}
+
+bool AtomSpool::ensureOpen() {
+    if (map_ != nullptr)
+        return true;
+    const auto now = std::chrono::steady_clock::now();
+    if (last_open_attempt_ && now - *last_open_attempt_ < kReopenInterval)
+        return false;
+    last_open_attempt_ = now;
+    return open();
+}
+
+bool AtomSpool::open() {
+    fd_.reset(::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0640));
+    if (fd_ == -1) {
+        PLOG(WARNING) << "Unable to open " << path_;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) == -1) {
+        PLOG(ERROR) << "fstat " << path_;
+        fd_.reset();
+        return false;
+    }
+    if (static_cast<size_t>(st.st_size) != kAtomSpoolFileSize) {
+        // Allocate every block up front so that a full /data cannot fail a store
+        // into the mapping.
+        int ret = ftruncate(fd_, 0);
+        if (ret == 0)
+            ret = posix_fallocate(fd_, 0, kAtomSpoolFileSize);
+        if (ret != 0) {
+            LOG(ERROR) << "Unable to allocate " << path_;
+            fd_.reset();
+            return false;
+        }
+    }
+
+    void *map = mmap(nullptr, kAtomSpoolFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        PLOG(ERROR) << "mmap " << path_;
+        fd_.reset();
+        return false;
+    }
+    map_ = static_cast<uint8_t *>(map);
+    header_ = reinterpret_cast<AtomSpoolHeader *>(map_);
+    ring_ = map_ + kAtomSpoolPageSize;
+
+    recover();
+    return true;
+}
+
+void AtomSpool::recover() {
+    if (header_->magic != kAtomSpoolMagic || header_->version != kAtomSpoolVersion ||
+        header_->capacity != kAtomSpoolCapacity || header_->crc != atomSpoolHeaderCrc(*header_) ||
+        header_->tail < header_->head || header_->tail - header_->head > kAtomSpoolCapacity) {
+        LOG(INFO) << "Initializing atom spool " << path_;
+        memset(header_, 0, sizeof(*header_));
+        header_->magic = kAtomSpoolMagic;
+        header_->version = kAtomSpoolVersion;
+        header_->capacity = kAtomSpoolCapacity;
+        updateHeader();
+        flush();
+        return;
+    }
+
+    // The header is written after the record it covers, so everything up to tail
+    // should be intact; cut the ring at the first record that is not.
+    std::vector<uint8_t> payload;
+    uint64_t offset = header_->head;
+    while (offset < header_->tail) {
+        uint64_t next;
+        if (!readRecord(offset, &payload, &next)) {
+            LOG(WARNING) << "Atom spool " << path_ << ": dropping "
+                         << header_->tail - offset << " corrupt bytes";
+            corrupt_++;
+            header_->dropped++;
+            header_->tail = offset;
+            updateHeader();
+            break;
+        }
+        recovered_++;
+        offset = next;
+    }
+    LOG(INFO) << "Atom spool " << path_ << ": recovered " << recovered_ << " records";
+}
+
+void AtomSpool::copyOut(uint64_t offset, void *dst, size_t len) const {
+    const size_t pos = offset % kAtomSpoolCapacity;
+    const size_t first = std::min(len, kAtomSpoolCapacity - pos);
+    memcpy(dst, ring_ + pos, first);
+    memcpy(static_cast<uint8_t *>(dst) + first, ring_, len - first);
+}
+
+void AtomSpool::copyIn(uint64_t offset, const void *src, size_t len) {
+    const size_t pos = offset % kAtomSpoolCapacity;
+    const size_t first = std::min(len, kAtomSpoolCapacity - pos);
+    memcpy(ring_ + pos, src, first);
+    memcpy(ring_, static_cast<const uint8_t *>(src) + first, len - first);
+}
+
+bool AtomSpool::readRecord(uint64_t offset, std::vector<uint8_t> *payload,
+                           uint64_t *next) const {
+    AtomSpoolRecordHeader record;
+    if (header_->tail - offset < sizeof(record))
+        return false;
+    copyOut(offset, &record, sizeof(record));
+    if (record.length > kAtomSpoolMaxPayload ||
+        header_->tail - offset - sizeof(record) < record.length)
+        return false;
+
+    payload->resize(record.length);
+    copyOut(offset + sizeof(record), payload->data(), record.length);
+    if (record.crc != atomSpoolRecordCrc(record, payload->data()))
+        return false;
+    *next = offset + sizeof(record) + record.length;
+    return true;
+}
+
+void AtomSpool::evictOne() {
+    AtomSpoolRecordHeader record;
+    copyOut(header_->head, &record, sizeof(record));
+    header_->head += sizeof(record) + record.length;
+    header_->dropped++;
+    // Offsets handed out by peek() may now point into overwritten data.
+    peeked_.clear();
+}
+
+void AtomSpool::updateHeader() {
+    header_->crc = atomSpoolHeaderCrc(*header_);
+}
+
+bool AtomSpool::append(const VendorAtom &atom) {
+    std::vector<uint8_t> payload;
+    if (!encodeAtom(atom, &payload)) {
+        unencodable_++;
+        return false;
+    }
+    if (!ensureOpen())
+        return false;
+
+    AtomSpoolRecordHeader record = {
+        .length = static_cast<uint32_t>(payload.size()),
+        .real_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count(),
+    };
+    record.crc = atomSpoolRecordCrc(record, payload.data());
+
+    const size_t need = sizeof(record) + payload.size();
+    while (header_->tail - header_->head + need > kAtomSpoolCapacity)
+        evictOne();
+    copyIn(header_->tail, &record, sizeof(record));
+    copyIn(header_->tail + sizeof(record), payload.data(), payload.size());
+    header_->tail += need;
+    header_->spooled++;
+    updateHeader();
+    return true;
+}
+
+void AtomSpool::flush() {
+    if (map_ == nullptr)
+        return;
+    // The blocks are preallocated, so this only starts writeback of dirty pages.
+    if (sync_file_range(fd_, 0, 0, SYNC_FILE_RANGE_WRITE) == -1)
+        PLOG(WARNING) << "sync_file_range " << path_;
+}
+
+bool AtomSpool::empty() const {
+    return map_ == nullptr || header_->head == header_->tail;
+}
+
+size_t AtomSpool::peek(size_t max, std::vector<VendorAtom> *atoms) {
+    peeked_.clear();
+    if (!ensureOpen())
+        return 0;
+
+    std::vector<uint8_t> payload;
+    uint64_t offset = header_->head;
+    while (peeked_.size() < max && offset < header_->tail) {
+        uint64_t next;
+        if (!readRecord(offset, &payload, &next)) {
+            LOG(ERROR) << "Atom spool " << path_ << ": corrupt record at " << offset;
+            corrupt_++;
+            header_->dropped++;
+            header_->tail = offset;
+            updateHeader();
+            break;
+        }
+        VendorAtom atom;
+        if (!decodeAtom(payload, &atom)) {
+            corrupt_++;
+            // Skip the record if nothing precedes it, otherwise leave it for the next
+            // peek so that consume() counts stay aligned with the atoms returned.
+            if (!peeked_.empty())
+                break;
+            header_->head = next;
+            header_->dropped++;
+            updateHeader();
+            offset = next;
+            continue;
+        }
+        atoms->push_back(std::move(atom));
+        peeked_.push_back(next);
+        offset = next;
+    }
+    return peeked_.size();
+}
+
+void AtomSpool::consume(size_t count) {
+    count = std::min(count, peeked_.size());
+    if (count == 0)
+        return;
+    header_->head = peeked_[count - 1];
+    header_->delivered += count;
+    updateHeader();
+    peeked_.clear();
+}
+
+std::string AtomSpool::dump() const {
+    if (map_ == nullptr)
+        return StringPrintf("Atom spool: %s not open, %" PRIu64 " unencodable\n", path_.c_str(),
+                            unencodable_);
+    return StringPrintf("Atom spool: %s %" PRIu64 "/%zu bytes pending, %" PRIu64
+                        " spooled, %" PRIu64 " delivered, %" PRIu64 " dropped, %zu recovered, %"
+                        PRIu64 " corrupt, %" PRIu64 " unencodable\n",
+                        path_.c_str(), header_->tail - header_->head, kAtomSpoolCapacity,
+                        header_->spooled, header_->delivered, header_->dropped, recovered_,
+                        corrupt_, unencodable_);
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
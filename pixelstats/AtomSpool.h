@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMSPOOL_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMSPOOL_H
+
+#include <aidl/android/frameworks/stats/IStats.h>
+#include <android-base/unique_fd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "AtomSpoolFormat.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using aidl::android::frameworks::stats::VendorAtom;
+
+/**
+ * Holds atoms that could not be delivered to IStats in an mmap'd ring file until
+ * they can be. When the ring is full the oldest records are evicted and counted as
+ * dropped. The file survives a pixelstats or device restart; records torn by a
+ * power loss fail their CRC and end the recovered range.
+ */
+class AtomSpool {
+  public:
+    explicit AtomSpool(std::string path);
+    ~AtomSpool();
+
+    // Returns false if the atom was not spooled.
+    bool append(const VendorAtom &atom);
+    // Starts writeback of everything appended or consumed so far.
+    void flush();
+
+    bool empty() const;
+    // Decodes up to max of the oldest records into atoms without removing them.
+    size_t peek(size_t max, std::vector<VendorAtom> *atoms);
+    // Removes the first count records returned by the last peek().
+    void consume(size_t count);
+
+    std::string dump() const;
+
+  private:
+    bool ensureOpen();
+    bool open();
+    void recover();
+    void copyOut(uint64_t offset, void *dst, size_t len) const;
+    void copyIn(uint64_t offset, const void *src, size_t len);
+    bool readRecord(uint64_t offset, std::vector<uint8_t> *payload, uint64_t *next) const;
+    void evictOne();
+    void updateHeader();
+
+    const std::string path_;
+    android::base::unique_fd fd_;
+    uint8_t *map_ = nullptr;
+    AtomSpoolHeader *header_ = nullptr;
+    uint8_t *ring_ = nullptr;
+    std::optional<std::chrono::steady_clock::time_point> last_open_attempt_;
+
+    // End offsets of the records returned by the last peek().
+    std::vector<uint64_t> peeked_;
+    // Since pixelstats started.
+    uint64_t unencodable_ = 0;
+    uint64_t corrupt_ = 0;
+    size_t recovered_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMSPOOL_H
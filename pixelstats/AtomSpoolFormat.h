@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMSPOOLFORMAT_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMSPOOLFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// On-disk layout of the atom spool, shared by pixelstats and the host decoder. All
+// fields are little endian.
+//
+// The file is one header page followed by a byte ring of kAtomSpoolCapacity bytes.
+// head and tail in the header are byte offsets that only grow; a record starts at
+// offset % kAtomSpoolCapacity and may wrap around the end of the ring. Each record is
+// an AtomSpoolRecordHeader followed by its payload:
+//
+//   u16 domain length, domain bytes, i32 atom id, u16 value count,
+//   then per value a u8 AtomSpoolValueTag and its data:
+//     int: i32, long: i64, float: f32, bool: u8, string: u16 length and bytes.
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+constexpr uint32_t kAtomSpoolMagic = 0x4c505341;  // "ASPL"
+constexpr uint32_t kAtomSpoolVersion = 1;
+constexpr size_t kAtomSpoolPageSize = 4096;
+constexpr size_t kAtomSpoolDataPages = 15;
+constexpr size_t kAtomSpoolCapacity = kAtomSpoolDataPages * kAtomSpoolPageSize;
+constexpr size_t kAtomSpoolFileSize = kAtomSpoolPageSize + kAtomSpoolCapacity;
+// Atoms whose payload would exceed this are not spooled.
+constexpr size_t kAtomSpoolMaxPayload = 1024;
+
+struct AtomSpoolHeader {
+    uint32_t crc;  // CRC32 of the bytes following this field
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint64_t head;  // offset of the oldest record not yet delivered
+    uint64_t tail;  // offset just past the newest record
+    // Over the lifetime of the file.
+    uint64_t spooled;
+    uint64_t delivered;
+    uint64_t dropped;  // evicted to make room, or lost to corruption
+};
+
+struct AtomSpoolRecordHeader {
+    uint32_t length;  // payload bytes
+    uint32_t crc;     // CRC32 of real_time_ms and the payload
+    int64_t real_time_ms;
+};
+
+static_assert(sizeof(AtomSpoolHeader) <= kAtomSpoolPageSize);
+static_assert(sizeof(AtomSpoolRecordHeader) == 16);
+
+enum AtomSpoolValueTag : uint8_t {
+    kAtomSpoolInt = 1,
+    kAtomSpoolLong = 2,
+    kAtomSpoolFloat = 3,
+    kAtomSpoolBool = 4,
+    kAtomSpoolString = 5,
+};
+
+// CRC-32 (IEEE 802.3), bitwise; the ring is only written when IStats is unavailable.
+inline uint32_t atomSpoolCrc32(const void *data, size_t len, uint32_t crc = 0) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+inline uint32_t atomSpoolHeaderCrc(const AtomSpoolHeader &header) {
+    return atomSpoolCrc32(reinterpret_cast<const uint8_t *>(&header) + sizeof(header.crc),
+                          sizeof(header) - sizeof(header.crc));
+}
+
+inline uint32_t atomSpoolRecordCrc(const AtomSpoolRecordHeader &record, const uint8_t *payload) {
+    uint32_t crc = atomSpoolCrc32(&record.real_time_ms, sizeof(record.real_time_ms));
+    return atomSpoolCrc32(payload, record.length, crc);
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_ATOMSPOOLFORMAT_H
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "BatteryEepromReader.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <fcntl.h>
+#include <pixelstats/BatteryEEPROMReporter.h>
+#include <pixelstats/StatsHelper.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <cinttypes>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using aidl::android::frameworks::stats::IStats;
+using android::base::boot_clock;
+using android::base::StringPrintf;
+
+namespace {
+
+constexpr uint32_t kCheckpointVersion = 1;
+// Bounds a pass over a device that never returns an erased record.
+constexpr uint32_t kMaxRecords = 256;
+
+uint32_t recordCrc(const std::string &record) {
+    return crc32(0, reinterpret_cast<const Bytef *>(record.data()), record.size());
+}
+
+// Unwritten EEPROM reads back as all ones.
+bool isErased(const std::string &record) {
+    for (char c : record) {
+        if (c != 'f' && c != 'F' && !isspace(static_cast<unsigned char>(c)))
+            return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+BatteryEepromReader::BatteryEepromReader(std::string path, std::string checkpointPath,
+                                         std::string spoolPath)
+    : path_(std::move(path)),
+      checkpoint_path_(std::move(checkpointPath)),
+      spool_path_(std::move(spoolPath)) {}
+
+// "<version> <index> <record size> <crc>"
+bool BatteryEepromReader::loadCheckpoint(Checkpoint *checkpoint) const {
+    std::string content;
+    if (!android::base::ReadFileToString(checkpoint_path_, &content))
+        return false;
+    std::vector<std::string> fields = android::base::Split(android::base::Trim(content), " ");
+    uint32_t version;
+    return fields.size() == 4 && android::base::ParseUint(fields[0], &version) &&
+           version == kCheckpointVersion && android::base::ParseUint(fields[1], &checkpoint->index) &&
+           android::base::ParseUint(fields[2], &checkpoint->record_size) &&
+           checkpoint->record_size > 0 && android::base::ParseUint(fields[3], &checkpoint->crc);
+}
+
+void BatteryEepromReader::saveCheckpoint(const Checkpoint &checkpoint) const {
+    std::string content = StringPrintf("%u %u %u %u\n", kCheckpointVersion, checkpoint.index,
+                                       checkpoint.record_size, checkpoint.crc);
+    // Written aside and renamed, so a crash never leaves a torn checkpoint.
+    std::string tmp = checkpoint_path_ + ".tmp";
+    if (!android::base::WriteStringToFile(content, tmp) ||
+        rename(tmp.c_str(), checkpoint_path_.c_str()))
+        PLOG(WARNING) << "Unable to write " << checkpoint_path_;
+}
+
+bool BatteryEepromReader::readRecord(int fd, uint32_t index, std::string *record) {
+    record->resize(LINESIZE);
+    ssize_t len = TEMP_FAILURE_RETRY(
+            pread(fd, record->data(), LINESIZE, static_cast<off_t>(index) * LINESIZE));
+    if (len > 0)
+        bytes_read_ += len;
+    return len == static_cast<ssize_t>(LINESIZE) && !isErased(*record);
+}
+
+void BatteryEepromReader::readFrom(int fd, uint32_t index, std::vector<std::string> *records) {
+    std::string record;
+    for (; index < kMaxRecords && readRecord(fd, index, &record); index++)
+        records->push_back(record);
+}
+
+bool BatteryEepromReader::fullScan(std::string *content, std::vector<std::string> *records) {
+    if (!android::base::ReadFileToString(path_, content)) {
+        PLOG(WARNING) << "Unable to read " << path_;
+        return false;
+    }
+    bytes_read_ += content->size();
+
+    // Lines, if the driver ends records with one, must end at a record boundary.
+    bool fixedSize = !content->empty() && content->size() % LINESIZE == 0;
+    for (size_t newline = content->find('\n'); fixedSize && newline != std::string::npos;
+         newline = content->find('\n', newline + 1))
+        fixedSize = newline % LINESIZE == LINESIZE - 1;
+    if (!fixedSize) {
+        LOG(WARNING) << path_ << " is not made of " << LINESIZE << " byte records";
+        return true;
+    }
+    for (size_t offset = 0; offset < content->size() && records->size() < kMaxRecords;
+         offset += LINESIZE) {
+        std::string record = content->substr(offset, LINESIZE);
+        if (isErased(record))
+            break;
+        records->push_back(std::move(record));
+    }
+    return true;
+}
+
+bool BatteryEepromReader::report(const std::string &history) {
+    const std::shared_ptr<IStats> stats_client = getStatsService();
+    if (!stats_client) {
+        LOG(ERROR) << "Unable to get AIDL Stats service";
+        return false;
+    }
+    if (!android::base::WriteStringToFile(history, spool_path_)) {
+        PLOG(ERROR) << "Unable to write " << spool_path_;
+        return false;
+    }
+    reporter_.checkAndReport(stats_client, spool_path_);
+    last_report_ = boot_clock::now();
+    unlink(spool_path_.c_str());
+    return true;
+}
+
+void BatteryEepromReader::collect() {
+    if (last_report_ && boot_clock::now() - *last_report_ < kReportInterval)
+        return;
+
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path_.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        PLOG(WARNING) << "Unable to open " << path_;
+        return;
+    }
+
+    Checkpoint checkpoint;
+    bool checkpointed = loadCheckpoint(&checkpoint) && checkpoint.record_size == LINESIZE;
+    std::string record;
+    std::vector<std::string> records;
+    uint32_t first = checkpointed ? checkpoint.index + 1 : 0;
+    if (checkpointed && readRecord(fd, checkpoint.index, &record) &&
+        recordCrc(record) == checkpoint.crc) {
+        incremental_passes_++;
+        readFrom(fd, first, &records);
+    } else {
+        full_scans_++;
+        std::string content;
+        std::vector<std::string> scanned;
+        if (!fullScan(&content, &scanned))
+            return;
+        if (scanned.empty()) {
+            // Not LINESIZE records; only the reporter knows how to parse them.
+            report(content);
+            return;
+        }
+        // The records up to the checkpointed index were reported already, even if the
+        // last of them changed since.
+        if (first < scanned.size())
+            records.assign(scanned.begin() + first, scanned.end());
+    }
+
+    if (records.empty() || !report(android::base::Join(records, "")))
+        return;
+    records_reported_ += records.size();
+    checkpoint.index = first + records.size() - 1;
+    checkpoint.record_size = LINESIZE;
+    checkpoint.crc = recordCrc(records.back());
+    saveCheckpoint(checkpoint);
+}
+
+std::string BatteryEepromReader::dump() const {
+    return StringPrintf("Battery EEPROM: %" PRIu64 " incremental passes, %" PRIu64
+                        " full scans, %" PRIu64 " bytes read, %" PRIu64 " records reported\n",
+                        incremental_passes_, full_scans_, bytes_read_, records_reported_);
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
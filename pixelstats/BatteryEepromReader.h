@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_BATTERYEEPROMREADER_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_BATTERYEEPROMREADER_H
+
+#include <android-base/chrono_utils.h>
+#include <pixelstats/BatteryEEPROMReporter.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Reads the battery history EEPROM incrementally. The history is a list of LINESIZE
+ * records that only grows, so a checkpoint of the last record reported, its index and
+ * the CRC of its contents, is kept under /data/vendor. A pass reads the checkpointed
+ * record back; if it still matches, only the records after it are read, otherwise the
+ * whole history is scanned again and only the records past the checkpointed index
+ * are new. New records are reported through one libpixelstats BatteryEEPROMReporter,
+ * so the atoms and their monthly rate limit are the same as before. A history with
+ * records of another size is handed to the reporter whole, as the SysfsCollector did.
+ */
+class BatteryEepromReader {
+  public:
+    BatteryEepromReader(std::string path, std::string checkpointPath, std::string spoolPath);
+
+    void collect();
+    std::string dump() const;
+
+  private:
+    struct Checkpoint {
+        uint32_t index;
+        uint32_t record_size;
+        uint32_t crc;
+    };
+
+    bool loadCheckpoint(Checkpoint *checkpoint) const;
+    void saveCheckpoint(const Checkpoint &checkpoint) const;
+    bool readRecord(int fd, uint32_t index, std::string *record);
+    // Appends the records from |index| on, up to the first erased one.
+    void readFrom(int fd, uint32_t index, std::vector<std::string> *records);
+    // Reads the whole history into |content| and splits it into |records|, which is
+    // left empty if the history is not made of LINESIZE records.
+    bool fullScan(std::string *content, std::vector<std::string> *records);
+    bool report(const std::string &history);
+
+    const std::string path_;
+    const std::string checkpoint_path_;
+    // Holds the new records while BatteryEEPROMReporter parses them.
+    const std::string spool_path_;
+
+    // The reporter drops what it is given within 30 days of its last report; passes
+    // are skipped until then so that the checkpoint only moves past reported records.
+    // A day of margin covers the wall clock the reporter measures this with.
+    static constexpr std::chrono::hours kReportInterval{24 * 31};
+    BatteryEEPROMReporter reporter_;
+    std::optional<android::base::boot_clock::time_point> last_report_;
+
+    uint64_t incremental_passes_ = 0;
+    uint64_t full_scans_ = 0;
+    uint64_t bytes_read_ = 0;
+    uint64_t records_reported_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_BATTERYEEPROMREADER_H
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "EventLoop.h"
+
+#include <android-base/logging.h>
+#include <sys/epoll.h>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+EventLoop::EventLoop() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epoll_fd_ < 0)
+        PLOG(ERROR) << "epoll_create1 failed";
+}
+
+bool EventLoop::addFd(int fd, std::function<void()> callback) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        PLOG(ERROR) << "epoll_ctl failed for fd " << fd;
+        return false;
+    }
+    callbacks_[fd] = std::move(callback);
+    return true;
+}
+
+void EventLoop::run() {
+    if (epoll_fd_ < 0)
+        return;
+
+    while (true) {
+        struct epoll_event events[8];
+        int nevents = epoll_wait(epoll_fd_, events, 8, -1);
+        if (nevents < 0) {
+            if (errno == EINTR)
+                continue;
+            PLOG(ERROR) << "epoll_wait failed";
+            return;
+        }
+        for (int i = 0; i < nevents; i++) {
+            auto it = callbacks_.find(events[i].data.fd);
+            if (it != callbacks_.end())
+                it->second();
+        }
+    }
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
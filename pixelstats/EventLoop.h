@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_EVENTLOOP_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_EVENTLOOP_H
+
+#include <android-base/unique_fd.h>
+
+#include <functional>
+#include <map>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Single-threaded epoll loop serving the gs201 collection timers and uevents. The
+ * libpixelstats UeventListener and SysfsCollector keep their own threads.
+ */
+class EventLoop {
+  public:
+    EventLoop();
+
+    // Fds are added before run().
+    bool addFd(int fd, std::function<void()> callback);
+    // Blocks forever.
+    void run();
+
+  private:
+    android::base::unique_fd epoll_fd_;
+    std::map<int, std::function<void()>> callbacks_;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_EVENTLOOP_H
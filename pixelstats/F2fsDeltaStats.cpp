@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "F2fsDeltaStats.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <device/google/gs201/pixelstats/gs201_pixelatoms.pb.h>
+#include <pixelstats/StatsHelper.h>
+
+#include <cinttypes>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::boot_clock;
+using android::base::StringPrintf;
+using android::hardware::google::pixel::PixelAtoms::ReverseDomainNames;
+using Gs201Atoms::F2fsDeltaReported;
+
+// Cumulative since mount.
+#define F2FS_COUNTER(name) {#name, &Counters::name}
+const F2fsDeltaStats::CounterNode F2fsDeltaStats::kCounterNodes[] = {
+        F2FS_COUNTER(gc_foreground_calls),     F2FS_COUNTER(gc_background_calls),
+        F2FS_COUNTER(moved_blocks_foreground), F2FS_COUNTER(moved_blocks_background),
+        F2FS_COUNTER(cp_foreground_calls),     F2FS_COUNTER(cp_background_calls),
+        F2FS_COUNTER(compr_written_block),     F2FS_COUNTER(compr_saved_block),
+};
+#undef F2FS_COUNTER
+
+F2fsDeltaStats::F2fsDeltaStats(const std::string &sysfsDir) : sysfs_dir_(sysfsDir) {
+    // iostat_info lives under procfs, named after the device like the sysfs directory.
+    std::string resolved;
+    if (android::base::Realpath(sysfsDir, &resolved))
+        iostat_path_ = "/proc/fs/f2fs/" + android::base::Basename(resolved) + "/iostat_info";
+    else
+        PLOG(WARNING) << "Unable to resolve " << sysfsDir;
+}
+
+std::vector<std::string> F2fsDeltaStats::nodes() const {
+    std::vector<std::string> nodes;
+    for (const auto &node : kCounterNodes)
+        nodes.push_back(sysfs_dir_ + "/" + node.name);
+    if (!iostat_path_.empty())
+        nodes.push_back(iostat_path_);
+    return nodes;
+}
+
+// [WRITE]
+// app buffered data:  <bytes>
+// ...
+// fs cp meta:         <bytes>
+// [READ]
+// ...
+bool F2fsDeltaStats::parseIostat(const std::string &content, Counters *counters) {
+    bool found = false, inWrite = false;
+    for (const auto &rawLine : android::base::Split(content, "\n")) {
+        std::string line = android::base::Trim(rawLine);
+        if (android::base::StartsWith(line, "[")) {
+            inWrite = line == "[WRITE]";
+            found |= inWrite;
+            continue;
+        }
+        size_t colon = line.find(':');
+        int64_t bytes;
+        if (!inWrite || colon == std::string::npos ||
+            !android::base::ParseInt(android::base::Trim(line.substr(colon + 1)), &bytes))
+            continue;
+
+        std::string name = line.substr(0, colon);
+        if (android::base::StartsWith(name, "app ")) {
+            counters->app_write_bytes += bytes;
+        } else if (android::base::StartsWith(name, "fs ")) {
+            counters->fs_write_bytes += bytes;
+            if (android::base::StartsWith(name, "fs cp "))
+                counters->cp_write_bytes += bytes;
+        }
+    }
+    return found;
+}
+
+bool F2fsDeltaStats::read(const SysfsReadResults &reads, Counters *counters) const {
+    for (const auto &node : kCounterNodes) {
+        auto read = reads.find(sysfs_dir_ + "/" + node.name);
+        if (read == reads.end() || !read->second.ok ||
+            !android::base::ParseInt(android::base::Trim(read->second.content),
+                                     &(counters->*node.field)))
+            return false;
+    }
+    if (iostat_path_.empty())
+        return true;
+    // A missed iostat read would show up as a burst of writes in the next interval.
+    auto read = reads.find(iostat_path_);
+    return read != reads.end() && read->second.ok && parseIostat(read->second.content, counters);
+}
+
+float F2fsDeltaStats::writeAmplification(const Counters &delta) {
+    return delta.app_write_bytes > 0
+                   ? static_cast<float>(delta.fs_write_bytes) / delta.app_write_bytes
+                   : 0;
+}
+
+float F2fsDeltaStats::compressionRatio(const Counters &delta) {
+    return delta.compr_written_block > 0
+                   ? static_cast<float>(delta.compr_written_block + delta.compr_saved_block) /
+                             delta.compr_written_block
+                   : 0;
+}
+
+void F2fsDeltaStats::reportDelta(const Counters &delta, int64_t seconds,
+                                 std::vector<VendorAtom> *atoms) {
+    std::vector<VendorAtomValue> values(F2fsDeltaReported::kCompressionRatioFieldNumber -
+                                        kVendorAtomOffset + 1);
+    auto setLong = [&values](int field, int64_t value) {
+        values[field - kVendorAtomOffset] =
+                VendorAtomValue::make<VendorAtomValue::longValue>(value);
+    };
+    setLong(F2fsDeltaReported::kIntervalSecondsFieldNumber, seconds);
+    setLong(F2fsDeltaReported::kGcForegroundCallsFieldNumber, delta.gc_foreground_calls);
+    setLong(F2fsDeltaReported::kGcBackgroundCallsFieldNumber, delta.gc_background_calls);
+    setLong(F2fsDeltaReported::kMovedBlocksForegroundFieldNumber, delta.moved_blocks_foreground);
+    setLong(F2fsDeltaReported::kMovedBlocksBackgroundFieldNumber, delta.moved_blocks_background);
+    setLong(F2fsDeltaReported::kCpForegroundCallsFieldNumber, delta.cp_foreground_calls);
+    setLong(F2fsDeltaReported::kCpBackgroundCallsFieldNumber, delta.cp_background_calls);
+    setLong(F2fsDeltaReported::kCpWriteBytesFieldNumber, delta.cp_write_bytes);
+    setLong(F2fsDeltaReported::kAppWriteBytesFieldNumber, delta.app_write_bytes);
+    setLong(F2fsDeltaReported::kFsWriteBytesFieldNumber, delta.fs_write_bytes);
+    setLong(F2fsDeltaReported::kComprWrittenBlocksFieldNumber, delta.compr_written_block);
+    setLong(F2fsDeltaReported::kComprSavedBlocksFieldNumber, delta.compr_saved_block);
+    values[F2fsDeltaReported::kWriteAmplificationFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(writeAmplification(delta));
+    values[F2fsDeltaReported::kCompressionRatioFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(compressionRatio(delta));
+    atoms->push_back({.reverseDomainName = ReverseDomainNames().pixel(),
+                      .atomId = Gs201Atoms::Atom::kF2fsDeltaReported,
+                      .values = std::move(values)});
+}
+
+void F2fsDeltaStats::collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+    Counters current;
+    if (!read(reads, &current))
+        return;
+    auto now = boot_clock::now();
+
+    // The first read, or one after a remount reset the counters, is only a baseline.
+    bool comparable = previous_.has_value();
+    bool changed = false;
+    Counters delta;
+    std::vector<int64_t Counters::*> fields = {&Counters::app_write_bytes,
+                                               &Counters::fs_write_bytes,
+                                               &Counters::cp_write_bytes};
+    for (const auto &node : kCounterNodes)
+        fields.push_back(node.field);
+    for (auto field : fields) {
+        if (!comparable)
+            break;
+        delta.*field = current.*field - previous_.value().*field;
+        comparable = delta.*field >= 0;
+        changed |= delta.*field > 0;
+    }
+
+    if (comparable && changed) {
+        last_delta_ = delta;
+        last_seconds_ =
+                std::chrono::duration_cast<std::chrono::seconds>(now - previous_time_).count();
+        reportDelta(delta, last_seconds_, atoms);
+    }
+    previous_ = current;
+    previous_time_ = now;
+}
+
+std::string F2fsDeltaStats::dump() const {
+    if (!last_delta_)
+        return "f2fs: no interval yet\n";
+    const Counters &delta = *last_delta_;
+    return StringPrintf("f2fs over %" PRId64 "s: GC %" PRId64 "/%" PRId64
+                        " fg/bg calls moving %" PRId64 "/%" PRId64 " blocks, checkpoints %" PRId64
+                        "/%" PRId64 " fg/bg writing %" PRId64 " bytes, write amplification "
+                        "%.2f (%" PRId64 " app bytes), compression ratio %.2f\n",
+                        last_seconds_, delta.gc_foreground_calls, delta.gc_background_calls,
+                        delta.moved_blocks_foreground, delta.moved_blocks_background,
+                        delta.cp_foreground_calls, delta.cp_background_calls,
+                        delta.cp_write_bytes, writeAmplification(delta), delta.app_write_bytes,
+                        compressionRatio(delta));
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_F2FSDELTASTATS_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_F2FSDELTASTATS_H
+
+#include <android-base/chrono_utils.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "AtomReporter.h"
+#include "SysfsReadPool.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Derives per-interval metrics from the cumulative f2fs counters of one mount and
+ * reports every interval with a change as an F2fsDeltaReported atom: foreground and
+ * background GC calls and the blocks they migrated, foreground and background
+ * checkpoints and the bytes they wrote, write amplification and the compression
+ * ratio. f2fs exposes no GC time or checkpoint latency outside debugfs, so migrated
+ * blocks per GC call and bytes per checkpoint stand in for them. Write amplification
+ * is the bytes f2fs wrote to the device over the bytes applications wrote, from the
+ * f2fs iostat counters. The last interval is kept for dump().
+ */
+class F2fsDeltaStats {
+  public:
+    // |sysfsDir| is the f2fs sysfs directory of the mount, or a link to it.
+    explicit F2fsDeltaStats(const std::string &sysfsDir);
+
+    std::vector<std::string> nodes() const;
+    void collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms);
+    std::string dump() const;
+
+  private:
+    struct Counters {
+        int64_t gc_foreground_calls = 0;
+        int64_t gc_background_calls = 0;
+        int64_t moved_blocks_foreground = 0;
+        int64_t moved_blocks_background = 0;
+        int64_t cp_foreground_calls = 0;
+        int64_t cp_background_calls = 0;
+        int64_t compr_written_block = 0;
+        int64_t compr_saved_block = 0;
+        // From iostat_info, in bytes.
+        int64_t app_write_bytes = 0;
+        int64_t fs_write_bytes = 0;
+        int64_t cp_write_bytes = 0;
+    };
+
+    struct CounterNode {
+        const char *name;
+        int64_t Counters::*field;
+    };
+    static const CounterNode kCounterNodes[];
+
+    bool read(const SysfsReadResults &reads, Counters *counters) const;
+    static bool parseIostat(const std::string &content, Counters *counters);
+    static float writeAmplification(const Counters &delta);
+    static float compressionRatio(const Counters &delta);
+    static void reportDelta(const Counters &delta, int64_t seconds,
+                            std::vector<VendorAtom> *atoms);
+
+    std::string sysfs_dir_;
+    // Empty if the mount could not be resolved.
+    std::string iostat_path_;
+    std::optional<Counters> previous_;
+    android::base::boot_clock::time_point previous_time_;
+    // Differences over the last interval with any, and its length.
+    std::optional<Counters> last_delta_;
+    int64_t last_seconds_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_F2FSDELTASTATS_H
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "IrqLatencyAnalyzer.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <device/google/gs201/pixelstats/gs201_pixelatoms.pb.h>
+#include <pixelstats/StatsHelper.h>
+#include <time.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cinttypes>
+#include <optional>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::boot_clock;
+using android::base::StringPrintf;
+using android::base::WriteStringToFile;
+using android::hardware::google::pixel::PixelAtoms::ReverseDomainNames;
+using Gs201Atoms::IrqLatencyDigestReported;
+
+namespace {
+
+constexpr std::string_view kLongSoftirqCount = "long SOFTIRQ count:";
+constexpr std::string_view kLongSoftirqDetail = "long SOFTIRQ detail";
+constexpr std::string_view kLongIrqCount = "long IRQ count:";
+constexpr std::string_view kLongIrqDetail = "long IRQ detail";
+constexpr std::string_view kStormIrqDetail = "storm IRQ detail";
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.front())))
+        s.remove_prefix(1);
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.back())))
+        s.remove_suffix(1);
+    return s;
+}
+
+bool startsWith(std::string_view s, std::string_view prefix) {
+    return s.substr(0, prefix.size()) == prefix;
+}
+
+// Calls |f| on each trimmed line, without copying the content.
+template <typename F>
+void forEachLine(std::string_view content, F f) {
+    while (!content.empty()) {
+        size_t end = content.find('\n');
+        f(trim(content.substr(0, end)));
+        if (end == std::string_view::npos)
+            break;
+        content.remove_prefix(end + 1);
+    }
+}
+
+template <typename T>
+bool parseNumber(std::string_view s, T *value) {
+    s = trim(s);
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), *value);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+// "<num> <value>"
+bool parseDetail(std::string_view line, int *num, int64_t *value) {
+    size_t space = line.find_first_of(" \t");
+    return space != std::string_view::npos && parseNumber(line.substr(0, space), num) &&
+           parseNumber(line.substr(space), value);
+}
+
+template <size_t N>
+std::string encodeHistogram(const std::array<uint64_t, N> &histogram) {
+    std::string encoded;
+    for (size_t i = 0; i < histogram.size(); i++) {
+        if (histogram[i] == 0)
+            continue;
+        if (!encoded.empty())
+            encoded += ',';
+        encoded += std::to_string(i) + ':' + std::to_string(histogram[i]);
+    }
+    return encoded;
+}
+
+}  // namespace
+
+IrqLatencyAnalyzer::IrqLatencyAnalyzer(std::string longIrqPath, std::string stormIrqPath,
+                                       std::string resetPath)
+    : long_irq_path_(std::move(longIrqPath)),
+      storm_irq_path_(std::move(stormIrqPath)),
+      reset_path_(std::move(resetPath)) {}
+
+std::vector<std::string> IrqLatencyAnalyzer::nodes() const {
+    return {long_irq_path_, storm_irq_path_};
+}
+
+size_t IrqLatencyAnalyzer::bucketOf(int64_t latencyNs) {
+    uint64_t us = latencyNs > 0 ? latencyNs / 1000 : 0;
+    size_t bucket = 63 - __builtin_clzll(us | 1);
+    return std::min(bucket, kBuckets - 1);
+}
+
+// "s3" for softirq 3, "i140" for irq 140.
+std::string IrqLatencyAnalyzer::keyName(const Key &key) {
+    return (key.first == Kind::kSoftirq ? "s" : "i") + std::to_string(key.second);
+}
+
+void IrqLatencyAnalyzer::addLatency(Totals *totals, const Key &key, int64_t latencyNs) {
+    Aggregate &aggregate = totals->aggregates[key];
+    aggregate.count++;
+    aggregate.max_latency_ns = std::max(aggregate.max_latency_ns, latencyNs);
+    aggregate.histogram[bucketOf(latencyNs)]++;
+}
+
+void IrqLatencyAnalyzer::addOffender(const Key &key, int64_t latencyNs) {
+    auto cmp = [](const Offender &a, const Offender &b) { return a.latency_ns > b.latency_ns; };
+    auto now = std::chrono::system_clock::now();
+    auto existing = std::find_if(top_.begin(), top_.end(),
+                                 [&key](const Offender &o) { return o.key == key; });
+    if (existing != top_.end()) {
+        // One entry per IRQ, so a single noisy IRQ cannot fill the list.
+        if (latencyNs > existing->latency_ns) {
+            *existing = {key, latencyNs, now};
+            std::make_heap(top_.begin(), top_.end(), cmp);
+        }
+    } else if (top_.size() < kTopOffenders) {
+        top_.push_back({key, latencyNs, now});
+        std::push_heap(top_.begin(), top_.end(), cmp);
+    } else if (latencyNs > top_.front().latency_ns) {
+        std::pop_heap(top_.begin(), top_.end(), cmp);
+        top_.back() = {key, latencyNs, now};
+        std::push_heap(top_.begin(), top_.end(), cmp);
+    }
+}
+
+void IrqLatencyAnalyzer::addStorms(Totals *totals, const Key &key, uint64_t storms) {
+    totals->aggregates[key].storms += storms;
+    totals->storms += storms;
+}
+
+bool IrqLatencyAnalyzer::parseLongIrqs(std::string_view content, Snapshot *snapshot) {
+    bool recognized = false;
+    std::optional<Kind> section;
+    forEachLine(content, [&](std::string_view line) {
+        if (startsWith(line, kLongSoftirqCount)) {
+            recognized = true;
+            section.reset();
+            parseNumber(line.substr(kLongSoftirqCount.size()), &snapshot->long_softirqs);
+        } else if (startsWith(line, kLongIrqCount)) {
+            recognized = true;
+            section.reset();
+            parseNumber(line.substr(kLongIrqCount.size()), &snapshot->long_irqs);
+        } else if (startsWith(line, kLongSoftirqDetail)) {
+            section = Kind::kSoftirq;
+        } else if (startsWith(line, kLongIrqDetail)) {
+            section = Kind::kIrq;
+        } else if (section) {
+            int num;
+            int64_t latencyNs;
+            if (parseDetail(line, &num, &latencyNs)) {
+                int64_t &latest = snapshot->latencies_ns[{*section, num}];
+                latest = std::max(latest, latencyNs);
+            }
+        }
+    });
+    return recognized;
+}
+
+bool IrqLatencyAnalyzer::parseStorms(std::string_view content, Snapshot *snapshot) {
+    bool recognized = false;
+    forEachLine(content, [&](std::string_view line) {
+        if (startsWith(line, kStormIrqDetail)) {
+            recognized = true;
+            return;
+        }
+        int num;
+        int64_t storms;
+        if (recognized && parseDetail(line, &num, &storms) && storms > 0)
+            snapshot->storms[{Kind::kIrq, num}] = storms;
+    });
+    return recognized;
+}
+
+void IrqLatencyAnalyzer::fold(const Snapshot &current, Totals *interval) {
+    // Counts only grow and listed IRQs stay listed until the stats are reset; after a
+    // reset everything in |current| is new.
+    bool reset = current.long_softirqs < previous_.long_softirqs ||
+                 current.long_irqs < previous_.long_irqs;
+    for (const auto &[key, latencyNs] : previous_.latencies_ns) {
+        auto it = current.latencies_ns.find(key);
+        reset = reset || it == current.latencies_ns.end() || it->second < latencyNs;
+    }
+    for (const auto &[key, storms] : previous_.storms) {
+        auto it = current.storms.find(key);
+        reset = reset || it == current.storms.end() || it->second < storms;
+    }
+    const Snapshot base = reset ? Snapshot() : previous_;
+
+    interval->long_softirqs = current.long_softirqs - base.long_softirqs;
+    interval->long_irqs = current.long_irqs - base.long_irqs;
+    boot_.long_softirqs += interval->long_softirqs;
+    boot_.long_irqs += interval->long_irqs;
+    // The kernel lists the worst latency of each IRQ; one that grew is a new long one.
+    for (const auto &[key, latencyNs] : current.latencies_ns) {
+        auto it = base.latencies_ns.find(key);
+        if (it == base.latencies_ns.end() || it->second != latencyNs) {
+            addLatency(interval, key, latencyNs);
+            addLatency(&boot_, key, latencyNs);
+            addOffender(key, latencyNs);
+        }
+    }
+    for (const auto &[key, storms] : current.storms) {
+        auto it = base.storms.find(key);
+        uint64_t previous = it == base.storms.end() ? 0 : it->second;
+        if (storms > previous) {
+            addStorms(interval, key, storms - previous);
+            addStorms(&boot_, key, storms - previous);
+        }
+    }
+    previous_ = current;
+}
+
+void IrqLatencyAnalyzer::reportDigest(const Totals &interval,
+                                      std::vector<VendorAtom> *atoms) const {
+    std::vector<std::pair<Key, int64_t>> worst;
+    std::string storms;
+    std::array<uint64_t, kBuckets> histogram = {};
+    for (const auto &[key, aggregate] : interval.aggregates) {
+        if (aggregate.count > 0)
+            worst.emplace_back(key, aggregate.max_latency_ns);
+        if (aggregate.storms > 0) {
+            if (!storms.empty())
+                storms += ',';
+            storms += keyName(key) + ':' + std::to_string(aggregate.storms);
+        }
+        for (size_t i = 0; i < kBuckets; i++)
+            histogram[i] += aggregate.histogram[i];
+    }
+    std::sort(worst.begin(), worst.end(),
+              [](const auto &a, const auto &b) { return a.second > b.second; });
+    worst.resize(std::min(worst.size(), kTopOffenders));
+    std::string worstLatencies;
+    for (const auto &[key, latencyNs] : worst) {
+        if (!worstLatencies.empty())
+            worstLatencies += ',';
+        worstLatencies += keyName(key) + ':' + std::to_string(latencyNs);
+    }
+
+    int64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(
+                              boot_clock::now() - interval_start_)
+                              .count();
+    std::vector<VendorAtomValue> values(IrqLatencyDigestReported::kLatencyHistogramFieldNumber -
+                                        kVendorAtomOffset + 1);
+    values[IrqLatencyDigestReported::kIntervalSecondsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(seconds);
+    values[IrqLatencyDigestReported::kLongSoftirqCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(interval.long_softirqs);
+    values[IrqLatencyDigestReported::kLongIrqCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(interval.long_irqs);
+    values[IrqLatencyDigestReported::kStormCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(interval.storms);
+    values[IrqLatencyDigestReported::kWorstLatenciesFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(worstLatencies);
+    values[IrqLatencyDigestReported::kStormsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(storms);
+    values[IrqLatencyDigestReported::kLatencyHistogramFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(encodeHistogram(histogram));
+    atoms->push_back({.reverseDomainName = ReverseDomainNames().pixel(),
+                      .atomId = Gs201Atoms::Atom::kIrqLatencyDigestReported,
+                      .values = std::move(values)});
+}
+
+void IrqLatencyAnalyzer::collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+    auto longIrqs = reads.find(long_irq_path_);
+    auto storms = reads.find(storm_irq_path_);
+    // Without both reads nothing is folded; the difference is taken at the next one.
+    if (longIrqs == reads.end() || !longIrqs->second.ok || storms == reads.end() ||
+        !storms->second.ok)
+        return;
+
+    Snapshot current;
+    bool parsed = parseLongIrqs(longIrqs->second.content, &current);
+    parsed = parseStorms(storms->second.content, &current) && parsed;
+    if (!parsed) {
+        LOG(WARNING) << "Unrecognized IRQ metrics in " << long_irq_path_ << " or "
+                     << storm_irq_path_;
+        return;
+    }
+    Totals interval;
+    fold(current, &interval);
+    interval.reads = 1;
+    boot_.reads++;
+    reportDigest(interval, atoms);
+    interval_start_ = boot_clock::now();
+
+    // Clears the worst latency of each listed IRQ, so that the next interval sees the
+    // long ones that are not worse than before.
+    if (WriteStringToFile("1", reset_path_))
+        previous_ = Snapshot();
+    else
+        PLOG(WARNING) << "Unable to reset " << reset_path_;
+}
+
+std::string IrqLatencyAnalyzer::dump() const {
+    std::string dump = StringPrintf("IRQ latency since boot: %" PRIu64 " reads, %" PRIu64
+                                    " long softirqs, %" PRIu64 " long irqs, %" PRIu64
+                                    " storms\n",
+                                    boot_.reads, boot_.long_softirqs, boot_.long_irqs,
+                                    boot_.storms);
+
+    std::vector<Offender> top = top_;
+    std::sort(top.begin(), top.end(),
+              [](const Offender &a, const Offender &b) { return a.latency_ns > b.latency_ns; });
+    dump += "Worst latencies (ns):\n";
+    for (const auto &offender : top) {
+        time_t t = std::chrono::system_clock::to_time_t(offender.time);
+        struct tm tm;
+        char when[32] = "";
+        if (localtime_r(&t, &tm) != nullptr)
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        dump += StringPrintf("  %-6s %12" PRId64 "  %s\n", keyName(offender.key).c_str(),
+                             offender.latency_ns, when);
+    }
+
+    dump += "Per IRQ (count, storms, max ns, log2 us histogram):\n";
+    for (const auto &[key, aggregate] : boot_.aggregates) {
+        dump += StringPrintf("  %-6s %6" PRIu64 " %6" PRIu64 " %12" PRId64 "  %s\n",
+                             keyName(key).c_str(), aggregate.count, aggregate.storms,
+                             aggregate.max_latency_ns,
+                             encodeHistogram(aggregate.histogram).c_str());
+    }
+    return dump;
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_IRQLATENCYANALYZER_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_IRQLATENCYANALYZER_H
+
+#include <android-base/chrono_utils.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "AtomReporter.h"
+#include "SysfsReadPool.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Owns the long IRQ and IRQ storm metrics, which the SysfsCollector no longer reads.
+ * Each read is folded into per-IRQ and per-softirq aggregates, both for the interval
+ * since the previous read and since start, together with the worst latencies seen.
+ * The interval is reported as an IrqLatencyDigestReported atom, after which the kernel
+ * stats are reset. If the reset fails the next read is folded as the difference to
+ * this one.
+ */
+class IrqLatencyAnalyzer {
+  public:
+    IrqLatencyAnalyzer(std::string longIrqPath, std::string stormIrqPath,
+                       std::string resetPath);
+
+    std::vector<std::string> nodes() const;
+    void collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms);
+    std::string dump() const;
+
+  private:
+    // Bucket i counts latencies in [2^i, 2^(i+1)) us; the last one is open ended.
+    static constexpr size_t kBuckets = 20;
+    static constexpr size_t kTopOffenders = 10;
+
+    enum class Kind { kSoftirq, kIrq };
+    using Key = std::pair<Kind, int>;
+
+    struct Aggregate {
+        // Reads in which the IRQ was listed as long.
+        uint64_t count = 0;
+        uint64_t storms = 0;
+        int64_t max_latency_ns = 0;
+        std::array<uint64_t, kBuckets> histogram = {};
+    };
+
+    struct Totals {
+        uint64_t reads = 0;
+        uint64_t long_softirqs = 0;
+        uint64_t long_irqs = 0;
+        uint64_t storms = 0;
+        std::map<Key, Aggregate> aggregates;
+    };
+
+    // What the kernel reported at the previous read, cumulative since its last reset.
+    struct Snapshot {
+        uint64_t long_softirqs = 0;
+        uint64_t long_irqs = 0;
+        std::map<Key, int64_t> latencies_ns;
+        std::map<Key, uint64_t> storms;
+    };
+
+    struct Offender {
+        Key key;
+        int64_t latency_ns;
+        std::chrono::system_clock::time_point time;
+    };
+
+    static size_t bucketOf(int64_t latencyNs);
+    static std::string keyName(const Key &key);
+    static bool parseLongIrqs(std::string_view content, Snapshot *snapshot);
+    static bool parseStorms(std::string_view content, Snapshot *snapshot);
+    static void addLatency(Totals *totals, const Key &key, int64_t latencyNs);
+    static void addStorms(Totals *totals, const Key &key, uint64_t storms);
+    // Folds what changed since the previous read into |interval| and the boot totals.
+    void fold(const Snapshot &current, Totals *interval);
+    void addOffender(const Key &key, int64_t latencyNs);
+    void reportDigest(const Totals &interval, std::vector<VendorAtom> *atoms) const;
+
+    const std::string long_irq_path_;
+    const std::string storm_irq_path_;
+    const std::string reset_path_;
+
+    Totals boot_;
+    // When the interval of the next digest started; zero for boot.
+    android::base::boot_clock::time_point interval_start_;
+    Snapshot previous_;
+    // Min-heap on latency, so the least bad of the kept offenders is evicted first.
+    std::vector<Offender> top_;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_IRQLATENCYANALYZER_H
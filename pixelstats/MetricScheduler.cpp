@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "MetricScheduler.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::boot_clock;
+using android::base::StringAppendF;
+
+// Bounds how often uevents can pull a group ahead of its period.
+constexpr auto kMinTriggeredInterval = std::chrono::minutes(1);
+// The SysfsCollector also waits this long on launch for drivers to finish probing.
+constexpr auto kStartDelay = std::chrono::seconds(30);
+
+MetricScheduler::MetricScheduler(SysfsReadPool *readPool, AtomReporter *reporter)
+    : read_pool_(readPool),
+      reporter_(reporter),
+      timer_fd_(timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC)) {
+    if (timer_fd_ < 0)
+        PLOG(ERROR) << "timerfd_create failed";
+}
+
+void MetricScheduler::addGroup(MetricGroup group) {
+    entries_.push_back({std::move(group), boot_clock::time_point::max(), {}, 0, {}});
+}
+
+void MetricScheduler::arm() {
+    if (entries_.empty())
+        return;
+
+    auto next = std::min_element(entries_.begin(), entries_.end(),
+                                 [](const Entry &a, const Entry &b) { return a.due < b.due; })
+                        ->due;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(next.time_since_epoch())
+                      .count();
+    struct itimerspec spec = {};
+    // An absolute time of zero would disarm the timer.
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = std::max<int64_t>(ns % 1000000000, 1);
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+        PLOG(ERROR) << "timerfd_settime failed";
+}
+
+void MetricScheduler::runDueGroups() {
+    auto now = boot_clock::now();
+    std::vector<Entry *> due;
+    for (auto &entry : entries_) {
+        if (entry.due - entry.group.jitter <= now)
+            due.push_back(&entry);
+    }
+    std::sort(due.begin(), due.end(), [](const Entry *a, const Entry *b) {
+        return a->group.priority < b->group.priority;
+    });
+
+    wakeups_++;
+    std::vector<std::string> nodes;
+    for (const Entry *entry : due)
+        nodes.insert(nodes.end(), entry->group.nodes.begin(), entry->group.nodes.end());
+    SysfsReadResults reads = read_pool_->readAll(nodes);
+
+    std::vector<VendorAtom> atoms;
+    for (Entry *entry : due) {
+        auto start = boot_clock::now();
+        entry->group.collect(reads, &atoms);
+        entry->lastDuration =
+                std::chrono::duration_cast<std::chrono::microseconds>(boot_clock::now() - start);
+        entry->lastRun = now;
+        entry->runs++;
+        // Rescheduling from the shared wakeup keeps batched groups aligned.
+        entry->due = now + entry->group.period;
+    }
+    reporter_->report(std::move(atoms));
+}
+
+void MetricScheduler::runNow(const std::string &name) {
+    auto now = boot_clock::now();
+    for (auto &entry : entries_) {
+        if (entry.group.name == name)
+            entry.due = std::min(entry.due, std::max(now, entry.lastRun + kMinTriggeredInterval));
+    }
+    arm();
+}
+
+void MetricScheduler::start() {
+    auto due = boot_clock::now() + kStartDelay;
+    for (auto &entry : entries_)
+        entry.due = due;
+    arm();
+}
+
+void MetricScheduler::onTimer() {
+    uint64_t expirations;
+    if (TEMP_FAILURE_RETRY(read(timer_fd_, &expirations, sizeof(expirations))) < 0 &&
+        errno != EAGAIN) {
+        PLOG(ERROR) << "timerfd read failed";
+        return;
+    }
+    runDueGroups();
+    arm();
+}
+
+std::string MetricScheduler::dump() const {
+    std::string out;
+    StringAppendF(&out, "Metric scheduler: %" PRIu64 " wakeups\n", wakeups_);
+    for (const auto &entry : entries_) {
+        StringAppendF(&out, "  %-16s period=%llds jitter=%llds prio=%d runs=%" PRIu64
+                      " last=%lldus\n",
+                      entry.group.name.c_str(),
+                      static_cast<long long>(entry.group.period.count()),
+                      static_cast<long long>(entry.group.jitter.count()), entry.group.priority,
+                      entry.runs, static_cast<long long>(entry.lastDuration.count()));
+    }
+    return out;
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_METRICSCHEDULER_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_METRICSCHEDULER_H
+
+#include <android-base/chrono_utils.h>
+#include <android-base/unique_fd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "AtomReporter.h"
+#include "SysfsReadPool.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * A group of metrics collected together on its own cadence.
+ */
+struct MetricGroup {
+    std::string name;
+    std::chrono::seconds period;
+    // How early the group may run so that it shares a wakeup with another due group.
+    std::chrono::seconds jitter;
+    // Lower values run first within a wakeup.
+    int priority;
+    // Nodes read before |collect| runs; the nodes of all groups due in a wakeup are
+    // read concurrently in one pass.
+    std::vector<std::string> nodes;
+    // Appends the atoms to report; the atoms of all groups in a wakeup are reported
+    // as one batch.
+    std::function<void(const SysfsReadResults &, std::vector<VendorAtom> *)> collect;
+};
+
+/**
+ * Runs metric groups from a single CLOCK_BOOTTIME timerfd. Every group first runs
+ * kStartDelay after start(), as the SysfsCollector's first pass does, and then once
+ * per period. Each wakeup runs every group that is due or within its jitter of being
+ * due, so groups with different periods are batched. The timer does not wake the
+ * device from suspend; groups that came due while suspended run on the next resume.
+ */
+class MetricScheduler {
+  public:
+    MetricScheduler(SysfsReadPool *readPool, AtomReporter *reporter);
+
+    // Groups are added before start().
+    void addGroup(MetricGroup group);
+    // Makes |name| due now, e.g. when a uevent says its metrics changed, but no sooner
+    // than kMinTriggeredInterval after its last run. Groups within their jitter of
+    // being due run in the same wakeup.
+    void runNow(const std::string &name);
+
+    // The timerfd to poll; call onTimer() when it is readable.
+    int timerFd() const { return timer_fd_.get(); }
+    // Schedules the first run of every group.
+    void start();
+    void onTimer();
+    std::string dump() const;
+
+  private:
+    struct Entry {
+        MetricGroup group;
+        android::base::boot_clock::time_point due;
+        android::base::boot_clock::time_point lastRun;
+        uint64_t runs;
+        std::chrono::microseconds lastDuration;
+    };
+
+    void runDueGroups();
+    void arm();
+
+    SysfsReadPool *const read_pool_;
+    AtomReporter *const reporter_;
+    android::base::unique_fd timer_fd_;
+    std::vector<Entry> entries_;
+    uint64_t wakeups_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_METRICSCHEDULER_H
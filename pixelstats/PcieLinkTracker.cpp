@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "PcieLinkTracker.h"
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <device/google/gs201/pixelstats/gs201_pixelatoms.pb.h>
+#include <pixelstats/StatsHelper.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::boot_clock;
+using android::base::StringPrintf;
+using android::hardware::google::pixel::PixelAtoms::ReverseDomainNames;
+using Gs201Atoms::PcieLinkBurstReported;
+using Gs201Atoms::PcieLinkDigestReported;
+
+namespace {
+
+// Counter nodes under link_stats, in the order of PcieLinkBurstReported::Event.
+constexpr const char *kEventNodes[] = {
+        "link_down_irqs",
+        "complete_timeout_irqs",
+        "link_up_failures",
+        "link_recovery_failures",
+};
+
+constexpr char kLinkUpHeader[] = "Link up:";
+constexpr char kLinkDownHeader[] = "Link down:";
+constexpr char kCountPrefix[] = "Cumulative count:";
+constexpr char kDurationPrefix[] = "Cumulative duration msec:";
+
+// Weight of the latest interval in the EWMA of the hourly rate.
+constexpr double kEwmaAlpha = 0.25;
+// An interval starts a burst when its rate is this many times the EWMA...
+constexpr double kBurstFactor = 4;
+// ...and it saw at least this many events, so a single event on a quiet link is not
+// a burst.
+constexpr int64_t kMinBurstEvents = 3;
+
+double upFraction(int64_t upMs, int64_t downMs) {
+    return upMs + downMs > 0 ? static_cast<double>(upMs) / (upMs + downMs) : 0;
+}
+
+}  // namespace
+
+PcieLinkTracker::PcieLinkTracker(std::string name, std::string linkStatsDir,
+                                 std::string powerStatsPath)
+    : name_(std::move(name)),
+      link_stats_dir_(std::move(linkStatsDir)),
+      power_stats_path_(std::move(powerStatsPath)),
+      digest_start_(boot_clock::now()) {}
+
+void PcieLinkTracker::Residency::add(const Residency &other) {
+    up_count += other.up_count;
+    up_ms += other.up_ms;
+    down_ms += other.down_ms;
+}
+
+std::vector<std::string> PcieLinkTracker::nodes() const {
+    std::vector<std::string> nodes;
+    for (const char *node : kEventNodes)
+        nodes.push_back(link_stats_dir_ + "/" + node);
+    nodes.push_back(power_stats_path_);
+    return nodes;
+}
+
+// Version: 1
+// Link up:
+//   Cumulative count: <n>
+//   Cumulative duration msec: <ms>
+//   Last entry timestamp msec: <ms>
+// Link down:
+//   ...
+bool PcieLinkTracker::parseResidency(const std::string &content, Residency *residency) {
+    enum { kNone, kUp, kDown } section = kNone;
+    bool up = false, down = false;
+    for (const auto &rawLine : android::base::Split(content, "\n")) {
+        std::string line = android::base::Trim(rawLine);
+        int64_t value;
+        if (line == kLinkUpHeader) {
+            section = kUp;
+            up = true;
+        } else if (line == kLinkDownHeader) {
+            section = kDown;
+            down = true;
+        } else if (android::base::StartsWith(line, kCountPrefix)) {
+            if (section == kUp &&
+                android::base::ParseInt(android::base::Trim(line.substr(strlen(kCountPrefix))),
+                                        &value))
+                residency->up_count = value;
+        } else if (android::base::StartsWith(line, kDurationPrefix)) {
+            if (!android::base::ParseInt(
+                        android::base::Trim(line.substr(strlen(kDurationPrefix))), &value))
+                continue;
+            if (section == kUp)
+                residency->up_ms = value;
+            else if (section == kDown)
+                residency->down_ms = value;
+        }
+    }
+    return up && down;
+}
+
+void PcieLinkTracker::reportBurst(size_t event, int64_t seconds, int64_t delta, double perHour,
+                                  double ewmaPerHour, const std::optional<Residency> &interval,
+                                  std::vector<VendorAtom> *atoms) const {
+    std::vector<VendorAtomValue> values(PcieLinkBurstReported::kLinkUpFractionFieldNumber -
+                                        kVendorAtomOffset + 1);
+    values[PcieLinkBurstReported::kLinkFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(name_);
+    values[PcieLinkBurstReported::kEventFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::intValue>(event + 1);
+    values[PcieLinkBurstReported::kIntervalSecondsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(seconds);
+    values[PcieLinkBurstReported::kEventCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(delta);
+    values[PcieLinkBurstReported::kRatePerHourFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(perHour);
+    values[PcieLinkBurstReported::kEwmaPerHourFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(ewmaPerHour);
+    values[PcieLinkBurstReported::kLinkUpCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(interval ? interval->up_count : -1);
+    values[PcieLinkBurstReported::kLinkUpFractionFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(
+                    interval ? upFraction(interval->up_ms, interval->down_ms) : -1);
+    atoms->push_back({.reverseDomainName = ReverseDomainNames().pixel(),
+                      .atomId = Gs201Atoms::Atom::kPcieLinkBurstReported,
+                      .values = std::move(values)});
+}
+
+void PcieLinkTracker::reportDigest(std::vector<VendorAtom> *atoms) {
+    if (digest_intervals_ == 0)
+        return;
+    auto now = boot_clock::now();
+    int64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(now - digest_start_).count();
+    int64_t bursts = 0;
+    double peakPerHour = 0;
+    for (const auto &event : events_) {
+        bursts += event.digest.bursts;
+        peakPerHour = std::max(peakPerHour, event.digest.peak_per_hour);
+    }
+
+    std::vector<VendorAtomValue> values(PcieLinkDigestReported::kLinkUpFractionFieldNumber -
+                                        kVendorAtomOffset + 1);
+    values[PcieLinkDigestReported::kLinkFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(name_);
+    values[PcieLinkDigestReported::kIntervalSecondsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(seconds);
+    const int eventFields[kEventTypes] = {
+            PcieLinkDigestReported::kLinkDownIrqsFieldNumber,
+            PcieLinkDigestReported::kCompleteTimeoutIrqsFieldNumber,
+            PcieLinkDigestReported::kLinkUpFailuresFieldNumber,
+            PcieLinkDigestReported::kLinkRecoveryFailuresFieldNumber,
+    };
+    for (size_t i = 0; i < kEventTypes; i++)
+        values[eventFields[i] - kVendorAtomOffset] =
+                VendorAtomValue::make<VendorAtomValue::longValue>(events_[i].digest.events);
+    values[PcieLinkDigestReported::kBurstCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(bursts);
+    values[PcieLinkDigestReported::kPeakPerHourFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(peakPerHour);
+    values[PcieLinkDigestReported::kLinkUpCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(digest_residency_.up_count);
+    values[PcieLinkDigestReported::kLinkUpFractionFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(
+                    upFraction(digest_residency_.up_ms, digest_residency_.down_ms));
+    atoms->push_back({.reverseDomainName = ReverseDomainNames().pixel(),
+                      .atomId = Gs201Atoms::Atom::kPcieLinkDigestReported,
+                      .values = std::move(values)});
+
+    for (auto &event : events_)
+        event.digest = Totals();
+    digest_residency_ = Residency();
+    digest_start_ = now;
+    digest_intervals_ = 0;
+}
+
+void PcieLinkTracker::collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+    auto now = boot_clock::now();
+    int64_t seconds =
+            have_previous_time_
+                    ? std::chrono::duration_cast<std::chrono::seconds>(now - previous_time_).count()
+                    : 0;
+    previous_time_ = now;
+    have_previous_time_ = true;
+    if (seconds > 0)
+        digest_intervals_++;
+
+    // Link residency over the interval, to tag bursts with.
+    std::optional<Residency> interval;
+    Residency residency;
+    auto power = reads.find(power_stats_path_);
+    if (power != reads.end() && power->second.ok &&
+        parseResidency(power->second.content, &residency)) {
+        if (previous_residency_ && residency.up_count >= previous_residency_->up_count &&
+            residency.up_ms >= previous_residency_->up_ms &&
+            residency.down_ms >= previous_residency_->down_ms) {
+            interval = Residency{residency.up_count - previous_residency_->up_count,
+                                 residency.up_ms - previous_residency_->up_ms,
+                                 residency.down_ms - previous_residency_->down_ms};
+            residency_.add(*interval);
+            digest_residency_.add(*interval);
+        }
+        previous_residency_ = residency;
+    }
+
+    for (size_t i = 0; i < kEventTypes; i++) {
+        auto read = reads.find(link_stats_dir_ + "/" + kEventNodes[i]);
+        int64_t count;
+        if (read == reads.end() || !read->second.ok ||
+            !android::base::ParseInt(android::base::Trim(read->second.content), &count))
+            continue;
+
+        EventState &event = events_[i];
+        std::optional<int64_t> previous = event.previous;
+        event.previous = count;
+        if (!previous || seconds <= 0)
+            continue;
+        int64_t delta = count >= *previous ? count - *previous : count;
+        double perHour = delta * 3600.0 / seconds;
+        bool burst = delta >= kMinBurstEvents && perHour >= kBurstFactor * event.ewma_per_hour;
+        bool newBurst = burst && !event.in_burst;
+        for (Totals *totals : {&event.total, &event.digest}) {
+            totals->events += delta;
+            totals->peak_per_hour = std::max(totals->peak_per_hour, perHour);
+            if (newBurst)
+                totals->bursts++;
+        }
+        if (newBurst) {
+            LOG(WARNING) << "PCIe " << name_ << " " << kEventNodes[i] << " burst: " << delta
+                         << " in " << seconds << "s, " << perHour << "/h against "
+                         << event.ewma_per_hour << "/h";
+            reportBurst(i, seconds, delta, perHour, event.ewma_per_hour, interval, atoms);
+        }
+        event.in_burst = burst;
+        event.ewma_per_hour = kEwmaAlpha * perHour + (1 - kEwmaAlpha) * event.ewma_per_hour;
+    }
+}
+
+std::string PcieLinkTracker::dump() const {
+    std::string dump = StringPrintf("PCIe %s:", name_.c_str());
+    for (size_t i = 0; i < kEventTypes; i++) {
+        dump += StringPrintf(" %s %" PRId64 " (%.1f/h ewma, %.1f/h peak, %" PRId64 " bursts%s)",
+                             kEventNodes[i], events_[i].total.events, events_[i].ewma_per_hour,
+                             events_[i].total.peak_per_hour, events_[i].total.bursts,
+                             events_[i].in_burst ? ", in burst" : "");
+    }
+    dump += StringPrintf(", link up %" PRId64 " times, %.1f%% of the time\n",
+                         residency_.up_count,
+                         100 * upFraction(residency_.up_ms, residency_.down_ms));
+    return dump;
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_PCIELINKTRACKER_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_PCIELINKTRACKER_H
+
+#include <android-base/chrono_utils.h>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "AtomReporter.h"
+#include "SysfsReadPool.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Owns the error counters of one PCIe link, which the SysfsCollector no longer reads,
+ * and tracks them as per-interval rates. Each event type keeps an EWMA of its hourly
+ * rate; an interval whose rate is well above the EWMA starts a burst, which is reported
+ * right away as a PcieLinkBurstReported atom, tagged with how often the link came up
+ * and how much of the interval it spent up according to its power_stats residency.
+ * reportDigest() reports the events, bursts and residency since the previous digest
+ * as a PcieLinkDigestReported atom, unless no interval was collected since. A counter
+ * that went backwards counts from zero.
+ */
+class PcieLinkTracker {
+  public:
+    PcieLinkTracker(std::string name, std::string linkStatsDir, std::string powerStatsPath);
+
+    std::vector<std::string> nodes() const;
+    void collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms);
+    void reportDigest(std::vector<VendorAtom> *atoms);
+    std::string dump() const;
+
+  private:
+    static constexpr size_t kEventTypes = 4;
+
+    struct Totals {
+        int64_t events = 0;
+        int64_t bursts = 0;
+        double peak_per_hour = 0;
+    };
+
+    struct EventState {
+        std::optional<int64_t> previous;
+        double ewma_per_hour = 0;
+        bool in_burst = false;
+        // Since pixelstats started, and since the previous digest.
+        Totals total;
+        Totals digest;
+    };
+
+    struct Residency {
+        int64_t up_count = 0;
+        int64_t up_ms = 0;
+        int64_t down_ms = 0;
+
+        void add(const Residency &other);
+    };
+
+    static bool parseResidency(const std::string &content, Residency *residency);
+    void reportBurst(size_t event, int64_t seconds, int64_t delta, double perHour,
+                     double ewmaPerHour, const std::optional<Residency> &interval,
+                     std::vector<VendorAtom> *atoms) const;
+
+    const std::string name_;
+    const std::string link_stats_dir_;
+    const std::string power_stats_path_;
+
+    std::array<EventState, kEventTypes> events_;
+    android::base::boot_clock::time_point previous_time_;
+    bool have_previous_time_ = false;
+    std::optional<Residency> previous_residency_;
+    // Since pixelstats started, and since the previous digest, over the intervals with
+    // a residency.
+    Residency residency_;
+    Residency digest_residency_;
+    android::base::boot_clock::time_point digest_start_;
+    // Collections that covered an interval since the previous digest.
+    int64_t digest_intervals_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_PCIELINKTRACKER_H
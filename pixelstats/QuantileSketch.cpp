@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "QuantileSketch.h"
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include <cinttypes>
+#include <cmath>
+#include <iterator>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::StringPrintf;
+
+namespace {
+
+// Values at or below this go to the zero count.
+constexpr double kMinIndexableValue = 1e-9;
+
+}  // namespace
+
+QuantileSketch::QuantileSketch(double relativeAccuracy, size_t maxBins)
+    : relative_accuracy_(relativeAccuracy),
+      gamma_((1 + relativeAccuracy) / (1 - relativeAccuracy)),
+      log_gamma_(std::log(gamma_)),
+      max_bins_(maxBins) {}
+
+int QuantileSketch::indexOf(double value) const {
+    return static_cast<int>(std::ceil(std::log(value) / log_gamma_));
+}
+
+double QuantileSketch::valueOf(int index) const {
+    // The point of the bin with the same relative distance to both of its bounds.
+    return 2 * std::pow(gamma_, index) / (gamma_ + 1);
+}
+
+void QuantileSketch::add(double value, uint64_t count) {
+    if (count == 0)
+        return;
+    if (value <= kMinIndexableValue)
+        zero_count_ += count;
+    else
+        bins_[indexOf(value)] += count;
+    count_ += count;
+    collapse();
+}
+
+bool QuantileSketch::merge(const QuantileSketch &other) {
+    if (relative_accuracy_ != other.relative_accuracy_) {
+        LOG(ERROR) << "Cannot merge sketches with relative accuracy " << relative_accuracy_
+                   << " and " << other.relative_accuracy_;
+        return false;
+    }
+    for (const auto &[index, count] : other.bins_)
+        bins_[index] += count;
+    zero_count_ += other.zero_count_;
+    count_ += other.count_;
+    collapse();
+    return true;
+}
+
+void QuantileSketch::clear() {
+    bins_.clear();
+    zero_count_ = 0;
+    count_ = 0;
+}
+
+void QuantileSketch::collapse() {
+    while (bins_.size() > max_bins_) {
+        auto lowest = bins_.begin();
+        std::next(lowest)->second += lowest->second;
+        bins_.erase(lowest);
+    }
+}
+
+double QuantileSketch::quantile(double q) const {
+    if (count_ == 0)
+        return 0;
+    const double rank = q * (count_ - 1);
+    uint64_t seen = zero_count_;
+    if (rank < seen)
+        return 0;
+    for (const auto &[index, count] : bins_) {
+        seen += count;
+        if (rank < seen)
+            return valueOf(index);
+    }
+    return valueOf(bins_.rbegin()->first);
+}
+
+std::string QuantileSketch::encode() const {
+    std::string encoded = StringPrintf("%g;%" PRIu64 ";", relative_accuracy_, zero_count_);
+    bool first = true;
+    for (const auto &[index, count] : bins_) {
+        if (!first)
+            encoded += ',';
+        first = false;
+        encoded += StringPrintf("%d:%" PRIu64, index, count);
+    }
+    return encoded;
+}
+
+bool QuantileSketch::decode(const std::string &encoded) {
+    std::vector<std::string> fields = android::base::Split(encoded, ";");
+    // The accuracy is compared as printed, like encode() does, not as a double.
+    if (fields.size() != 3 || fields[0] != StringPrintf("%g", relative_accuracy_))
+        return false;
+
+    std::map<int, uint64_t> bins;
+    uint64_t zeroCount, count;
+    if (!android::base::ParseUint(fields[1], &zeroCount))
+        return false;
+    count = zeroCount;
+    if (!fields[2].empty()) {
+        for (const auto &bin : android::base::Split(fields[2], ",")) {
+            std::vector<std::string> parts = android::base::Split(bin, ":");
+            int index;
+            uint64_t binCount;
+            if (parts.size() != 2 || !android::base::ParseInt(parts[0], &index) ||
+                !android::base::ParseUint(parts[1], &binCount))
+                return false;
+            bins[index] += binCount;
+            count += binCount;
+        }
+    }
+
+    bins_ = std::move(bins);
+    zero_count_ = zeroCount;
+    count_ = count;
+    collapse();
+    return true;
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
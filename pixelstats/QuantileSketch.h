@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_QUANTILESKETCH_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_QUANTILESKETCH_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * A DDSketch: positive values are counted in logarithmically sized bins, so any
+ * quantile is returned within |relativeAccuracy| of a value actually added. Two
+ * sketches with the same accuracy merge by adding their bins, which is what lets
+ * daily sketches from many devices be combined offline. When more than |maxBins|
+ * bins are in use the lowest ones are collapsed, trading accuracy at the low end,
+ * which matters least for latencies.
+ */
+class QuantileSketch {
+  public:
+    explicit QuantileSketch(double relativeAccuracy = 0.01, size_t maxBins = 512);
+
+    void add(double value, uint64_t count = 1);
+    // Fails if the sketches differ in accuracy.
+    bool merge(const QuantileSketch &other);
+    void clear();
+
+    uint64_t count() const { return count_; }
+    // Returns 0 for an empty sketch.
+    double quantile(double q) const;
+    // "<relative accuracy>;<zero count>;<bin index>:<count>,..." where bin i covers
+    // (gamma^(i-1), gamma^i] and gamma = (1 + accuracy) / (1 - accuracy).
+    std::string encode() const;
+    // Replaces the contents with those of encode()'s output. Fails, leaving the sketch
+    // as it was, if |encoded| is malformed or from a sketch of another accuracy.
+    bool decode(const std::string &encoded);
+
+  private:
+    int indexOf(double value) const;
+    double valueOf(int index) const;
+    void collapse();
+
+    const double relative_accuracy_;
+    const double gamma_;
+    const double log_gamma_;
+    const size_t max_bins_;
+    std::map<int, uint64_t> bins_;
+    // Values too small to have a bin.
+    uint64_t zero_count_ = 0;
+    uint64_t count_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_QUANTILESKETCH_H
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "ResumeLatencyTracker.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <device/google/gs201/pixelstats/gs201_pixelatoms.pb.h>
+#include <pixelstats/StatsHelper.h>
+
+#include <stdio.h>
+
+#include <cinttypes>
+#include <cstring>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::boot_clock;
+using android::base::StringPrintf;
+using android::hardware::google::pixel::PixelAtoms::ReverseDomainNames;
+using Gs201Atoms::ResumeLatencyDigestReported;
+
+namespace {
+
+constexpr char kMaxPrefix[] = "Max Resume Latency:";
+constexpr char kBucketSeparator[] = "====>";
+constexpr char kBootIdPath[] = "/proc/sys/kernel/random/boot_id";
+constexpr unsigned kStateVersion = 2;
+
+}  // namespace
+
+ResumeLatencyTracker::ResumeLatencyTracker(std::string path, int64_t breachThresholdMs,
+                                           std::string statePath)
+    : path_(std::move(path)),
+      breach_threshold_ms_(breachThresholdMs),
+      state_path_(std::move(statePath)) {
+    if (android::base::ReadFileToString(kBootIdPath, &boot_id_))
+        boot_id_ = android::base::Trim(boot_id_);
+    else
+        PLOG(WARNING) << "Unable to read " << kBootIdPath;
+    loadState();
+}
+
+// <version> <boot id>
+// <max ms> <breaches> <boot clock ns of the read>
+// <bucket count>,...
+// <QuantileSketch::encode()>
+void ResumeLatencyTracker::loadState() {
+    std::string content;
+    if (boot_id_.empty() || !android::base::ReadFileToString(state_path_, &content))
+        return;
+
+    std::vector<std::string> lines = android::base::Split(android::base::Trim(content), "\n");
+    if (lines.size() != 4)
+        return;
+    std::vector<std::string> header = android::base::Split(lines[0], " ");
+    unsigned version;
+    // State of an earlier boot describes counters the kernel no longer has.
+    if (header.size() != 2 || !android::base::ParseUint(header[0], &version) ||
+        version != kStateVersion || header[1] != boot_id_)
+        return;
+
+    std::vector<std::string> totals = android::base::Split(lines[1], " ");
+    int64_t maxMs;
+    uint64_t breaches;
+    int64_t readNs;
+    if (totals.size() != 3 || !android::base::ParseInt(totals[0], &maxMs) ||
+        !android::base::ParseUint(totals[1], &breaches) ||
+        !android::base::ParseInt(totals[2], &readNs))
+        return;
+    std::vector<int64_t> counts;
+    for (const auto &field : android::base::Split(lines[2], ",")) {
+        int64_t count;
+        if (!android::base::ParseInt(field, &count))
+            return;
+        counts.push_back(count);
+    }
+    if (!boot_.decode(lines[3])) {
+        LOG(WARNING) << "Discarding the resume latency sketch in " << state_path_;
+        return;
+    }
+
+    max_ms_ = maxMs;
+    boot_breaches_ = breaches;
+    previous_counts_ = std::move(counts);
+    previous_read_ = boot_clock::time_point(std::chrono::nanoseconds(readNs));
+}
+
+void ResumeLatencyTracker::saveState() const {
+    if (boot_id_.empty() || !previous_counts_)
+        return;
+    int64_t readNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             previous_read_.time_since_epoch())
+                             .count();
+    std::string content = StringPrintf("%u %s\n%" PRId64 " %" PRIu64 " %" PRId64 "\n",
+                                       kStateVersion, boot_id_.c_str(), max_ms_, boot_breaches_,
+                                       readNs);
+    std::vector<std::string> counts;
+    for (int64_t count : *previous_counts_)
+        counts.push_back(std::to_string(count));
+    content += android::base::Join(counts, ",") + "\n" + boot_.encode() + "\n";
+
+    // Written aside and renamed, so a crash never leaves a torn state.
+    std::string tmp = state_path_ + ".tmp";
+    if (!android::base::WriteStringToFile(content, tmp) ||
+        rename(tmp.c_str(), state_path_.c_str()))
+        PLOG(WARNING) << "Unable to write " << state_path_;
+}
+
+// Resume Latency Bucket Count: <n>
+// Max Resume Latency: <ms>
+// Sum Resume Latency: <ms>
+// <lower> - <upper>ms ====> <count>
+// ...
+// <lower> - infms ====> <count>
+bool ResumeLatencyTracker::parse(const std::string &content, Snapshot *snapshot) {
+    for (const auto &rawLine : android::base::Split(content, "\n")) {
+        std::string line = android::base::Trim(rawLine);
+        if (android::base::StartsWith(line, kMaxPrefix)) {
+            if (!android::base::ParseInt(android::base::Trim(line.substr(strlen(kMaxPrefix))),
+                                         &snapshot->max_ms))
+                return false;
+        } else if (auto pos = line.find(kBucketSeparator); pos != std::string::npos) {
+            std::vector<std::string> bounds = android::base::Split(line.substr(0, pos), "-");
+            if (bounds.size() != 2)
+                return false;
+            std::string upper = android::base::Trim(bounds[1]);
+            if (android::base::EndsWith(upper, "ms"))
+                upper.resize(upper.size() - 2);
+
+            Bucket bucket;
+            if (!android::base::ParseInt(android::base::Trim(bounds[0]), &bucket.lower_ms) ||
+                !android::base::ParseInt(
+                        android::base::Trim(line.substr(pos + strlen(kBucketSeparator))),
+                        &bucket.count))
+                return false;
+            if (upper != "inf") {
+                int64_t upperMs;
+                if (!android::base::ParseInt(upper, &upperMs))
+                    return false;
+                bucket.upper_ms = upperMs;
+            }
+            snapshot->buckets.push_back(bucket);
+        }
+    }
+    return !snapshot->buckets.empty();
+}
+
+void ResumeLatencyTracker::reportDigest(const QuantileSketch &sketch, uint64_t breaches,
+                                        std::vector<VendorAtom> *atoms) const {
+    int64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(boot_clock::now() -
+                                                                       previous_read_)
+                              .count();
+    std::vector<VendorAtomValue> values(ResumeLatencyDigestReported::kSketchFieldNumber -
+                                        kVendorAtomOffset + 1);
+    values[ResumeLatencyDigestReported::kIntervalSecondsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(seconds);
+    values[ResumeLatencyDigestReported::kResumeCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(sketch.count());
+    values[ResumeLatencyDigestReported::kP50MsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(sketch.quantile(0.5));
+    values[ResumeLatencyDigestReported::kP95MsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(sketch.quantile(0.95));
+    values[ResumeLatencyDigestReported::kP99MsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::floatValue>(sketch.quantile(0.99));
+    values[ResumeLatencyDigestReported::kMaxMsSinceBootFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(max_ms_);
+    values[ResumeLatencyDigestReported::kBreachThresholdMsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(breach_threshold_ms_);
+    values[ResumeLatencyDigestReported::kBreachCountFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(breaches);
+    values[ResumeLatencyDigestReported::kSketchFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(sketch.encode());
+    atoms->push_back({.reverseDomainName = ReverseDomainNames().pixel(),
+                      .atomId = Gs201Atoms::Atom::kResumeLatencyDigestReported,
+                      .values = std::move(values)});
+}
+
+void ResumeLatencyTracker::collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+    auto read = reads.find(path_);
+    if (read == reads.end() || !read->second.ok)
+        return;
+
+    Snapshot current;
+    if (!parse(read->second.content, &current)) {
+        LOG(WARNING) << "Unable to parse " << path_;
+        return;
+    }
+
+    // Without a previous read in this boot, everything the kernel counted is new. A
+    // snapshot after the bucket layout changed is only a baseline.
+    bool comparable = !previous_counts_ || previous_counts_->size() == current.buckets.size();
+    for (size_t i = 0; previous_counts_ && comparable && i < current.buckets.size(); i++)
+        comparable = current.buckets[i].count >= (*previous_counts_)[i];
+
+    QuantileSketch sketch;
+    uint64_t breaches = 0;
+    std::vector<int64_t> counts;
+    for (size_t i = 0; i < current.buckets.size(); i++) {
+        const Bucket &bucket = current.buckets[i];
+        counts.push_back(bucket.count);
+        int64_t resumes = 0;
+        if (comparable)
+            resumes = bucket.count - (previous_counts_ ? (*previous_counts_)[i] : 0);
+        if (resumes == 0)
+            continue;
+        double value = bucket.upper_ms ? (bucket.lower_ms + *bucket.upper_ms) / 2.0
+                                       : bucket.lower_ms;
+        sketch.add(value, resumes);
+        if (bucket.lower_ms >= breach_threshold_ms_)
+            breaches += resumes;
+    }
+    max_ms_ = current.max_ms;
+    if (sketch.count() > 0) {
+        reportDigest(sketch, breaches, atoms);
+        boot_.merge(sketch);
+        boot_breaches_ += breaches;
+    }
+    previous_counts_ = std::move(counts);
+    previous_read_ = boot_clock::now();
+    saveState();
+}
+
+std::string ResumeLatencyTracker::dump() const {
+    return StringPrintf("Resume latency since boot: %" PRIu64 " resumes, p50 %.1fms, p95 %.1fms, "
+                        "p99 %.1fms, max %" PRId64 "ms, %" PRIu64 " at or above %" PRId64 "ms\n",
+                        boot_.count(), boot_.quantile(0.5), boot_.quantile(0.95),
+                        boot_.quantile(0.99), max_ms_, boot_breaches_, breach_threshold_ms_);
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
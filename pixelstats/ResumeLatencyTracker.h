@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_RESUMELATENCYTRACKER_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_RESUMELATENCYTRACKER_H
+
+#include <android-base/chrono_utils.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "AtomReporter.h"
+#include "QuantileSketch.h"
+#include "SysfsReadPool.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Owns the resume latency metrics, which the SysfsCollector no longer reads. Each read
+ * turns the resumes the kernel counted since the previous read into a quantile sketch,
+ * placing them at the midpoint of their kernel bucket so the percentiles are as
+ * precise as the kernel buckets allow. The sketch is reported with its percentiles and
+ * the resumes at or above the breach threshold as a ResumeLatencyDigestReported atom,
+ * instead of the raw buckets, and merged into the since-boot sketch for dump(). The
+ * last read is saved to |statePath|, so a restart within the same boot continues
+ * where the previous run stopped instead of reporting the same resumes again.
+ */
+class ResumeLatencyTracker {
+  public:
+    ResumeLatencyTracker(std::string path, int64_t breachThresholdMs, std::string statePath);
+
+    std::vector<std::string> nodes() const { return {path_}; }
+    void collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms);
+    std::string dump() const;
+
+  private:
+    struct Bucket {
+        int64_t lower_ms;
+        // Unset for the open ended last bucket.
+        std::optional<int64_t> upper_ms;
+        int64_t count;
+    };
+
+    struct Snapshot {
+        int64_t max_ms = 0;
+        std::vector<Bucket> buckets;
+    };
+
+    static bool parse(const std::string &content, Snapshot *snapshot);
+    void reportDigest(const QuantileSketch &sketch, uint64_t breaches,
+                      std::vector<VendorAtom> *atoms) const;
+    void loadState();
+    void saveState() const;
+
+    const std::string path_;
+    const int64_t breach_threshold_ms_;
+    const std::string state_path_;
+    // Identifies the boot the state belongs to.
+    std::string boot_id_;
+    int64_t max_ms_ = 0;
+    // Bucket counts of the previous read; unset until the first one of the boot.
+    std::optional<std::vector<int64_t>> previous_counts_;
+    // Time of the previous read; zero, i.e. boot, until the first one.
+    android::base::boot_clock::time_point previous_read_;
+
+    QuantileSketch boot_;
+    uint64_t boot_breaches_ = 0;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_RESUMELATENCYTRACKER_H
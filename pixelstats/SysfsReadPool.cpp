@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "SysfsReadPool.h"
+
+#include <android-base/chrono_utils.h>
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::boot_clock;
+using android::base::StringAppendF;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr std::chrono::minutes kInitialBackoff = 1min;
+constexpr std::chrono::minutes kMaxBackoff = 60min;
+// Workers stuck in a read are replaced up to this many times the configured count.
+constexpr size_t kMaxThreadsFactor = 2;
+
+struct Batch {
+    std::condition_variable cv;
+    size_t pending = 0;
+};
+
+struct Job {
+    std::string path;
+    std::shared_ptr<Batch> batch;
+    std::optional<boot_clock::time_point> started;
+    bool done = false;
+    bool cancelled = false;
+    // Timed out while its worker was still reading.
+    bool stuck = false;
+    SysfsReadResult result;
+};
+
+struct Quarantine {
+    boot_clock::time_point until;
+    std::chrono::minutes backoff;
+    uint64_t timeouts;
+};
+
+}  // namespace
+
+struct SysfsReadPool::State {
+    explicit State(std::chrono::milliseconds timeout) : timeout(timeout) {}
+
+    void work(uint64_t id);
+    // Workers that are not stuck in a read.
+    size_t availableLocked() const { return running - stuck; }
+    bool isQuarantinedLocked(const std::string &path, boot_clock::time_point now);
+    void quarantineLocked(const std::string &path, boot_clock::time_point now);
+
+    const std::chrono::milliseconds timeout;
+    std::mutex lock;
+    std::condition_variable workCv;
+    // Signalled when a worker exits.
+    std::condition_variable exitCv;
+    std::deque<std::shared_ptr<Job>> queue;
+    std::map<std::string, Quarantine> quarantine;
+    std::map<uint64_t, std::thread> threads;
+    // Workers that returned from work() and can be joined.
+    std::vector<uint64_t> exited;
+    uint64_t nextId = 0;
+    // Number of workers to keep available.
+    size_t workers = 0;
+    size_t maxThreads = 0;
+    // Threads that have not returned from work(), including the stuck ones.
+    size_t running = 0;
+    size_t busy = 0;
+    size_t stuck = 0;
+    bool stop = false;
+    uint64_t reads = 0;
+    uint64_t timeouts = 0;
+    uint64_t replacements = 0;
+    // Times a stuck worker could not be replaced because of maxThreads.
+    uint64_t degradedPasses = 0;
+};
+
+void SysfsReadPool::State::work(uint64_t id) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        workCv.wait(guard, [this] { return stop || !queue.empty(); });
+        if (stop)
+            break;
+
+        std::shared_ptr<Job> job = queue.front();
+        queue.pop_front();
+        if (job->cancelled)
+            continue;
+        job->started = boot_clock::now();
+        busy++;
+
+        guard.unlock();
+        SysfsReadResult result;
+        result.ok = android::base::ReadFileToString(job->path, &result.content);
+        guard.lock();
+
+        busy--;
+        reads++;
+        job->result = std::move(result);
+        job->done = true;
+        job->batch->pending--;
+        job->batch->cv.notify_all();
+
+        if (job->stuck) {
+            stuck--;
+            // A replacement took over while this worker was stuck.
+            if (availableLocked() > workers) {
+                LOG(INFO) << "Read of " << job->path << " returned, retiring its worker";
+                break;
+            }
+        }
+    }
+    running--;
+    exited.push_back(id);
+    exitCv.notify_all();
+}
+
+bool SysfsReadPool::State::isQuarantinedLocked(const std::string &path,
+                                               boot_clock::time_point now) {
+    auto it = quarantine.find(path);
+    return it != quarantine.end() && now < it->second.until;
+}
+
+void SysfsReadPool::State::quarantineLocked(const std::string &path,
+                                            boot_clock::time_point now) {
+    auto [it, inserted] = quarantine.try_emplace(path, Quarantine{now, kInitialBackoff, 0});
+    Quarantine &entry = it->second;
+    if (!inserted)
+        entry.backoff = std::min(entry.backoff * 2, kMaxBackoff);
+    entry.until = now + entry.backoff;
+    entry.timeouts++;
+    timeouts++;
+    LOG(WARNING) << "Read of " << path << " timed out, quarantined for " << entry.backoff.count()
+                 << " min";
+}
+
+SysfsReadPool::SysfsReadPool(size_t workers, std::chrono::milliseconds timeout)
+    : state_(std::make_shared<State>(timeout)) {
+    std::lock_guard<std::mutex> guard(state_->lock);
+    state_->workers = workers;
+    state_->maxThreads = workers * kMaxThreadsFactor;
+    for (size_t i = 0; i < workers; i++)
+        spawnWorkerLocked();
+}
+
+SysfsReadPool::~SysfsReadPool() {
+    std::unique_lock<std::mutex> guard(state_->lock);
+    state_->stop = true;
+    state_->workCv.notify_all();
+    // A worker in the middle of a read exits once it returns.
+    state_->exitCv.wait_for(guard, state_->timeout, [this] { return state_->running == 0; });
+
+    std::map<uint64_t, std::thread> threads = std::move(state_->threads);
+    std::vector<uint64_t> exited = std::move(state_->exited);
+    guard.unlock();
+
+    for (uint64_t id : exited) {
+        threads[id].join();
+        threads.erase(id);
+    }
+    for (auto &[id, thread] : threads) {
+        LOG(WARNING) << "Sysfs read worker " << id << " is stuck in a read, detaching it";
+        thread.detach();
+    }
+}
+
+void SysfsReadPool::spawnWorkerLocked() {
+    uint64_t id = state_->nextId++;
+    state_->running++;
+    state_->threads.emplace(id, std::thread([state = state_, id] { state->work(id); }));
+}
+
+SysfsReadResults SysfsReadPool::readAll(const std::vector<std::string> &paths) {
+    SysfsReadResults results;
+    auto batch = std::make_shared<Batch>();
+    std::vector<std::shared_ptr<Job>> jobs;
+
+    std::unique_lock<std::mutex> guard(state_->lock);
+    // Workers that retired after a stuck read returned. They hold no lock once they
+    // are listed, so joining them here cannot block.
+    for (uint64_t id : state_->exited) {
+        state_->threads[id].join();
+        state_->threads.erase(id);
+    }
+    state_->exited.clear();
+
+    auto now = boot_clock::now();
+    for (const auto &path : paths) {
+        if (results.count(path))
+            continue;
+        results[path] = {};
+        if (state_->isQuarantinedLocked(path, now))
+            continue;
+        auto job = std::make_shared<Job>();
+        job->path = path;
+        job->batch = batch;
+        jobs.push_back(job);
+        state_->queue.push_back(job);
+        batch->pending++;
+    }
+    state_->workCv.notify_all();
+
+    // Every node gets |timeout| once a worker picks it up; the pass as a whole is
+    // bounded by the time the workers need to get through the queue.
+    size_t available = std::max<size_t>(state_->availableLocked(), 1);
+    size_t rounds = (jobs.size() + available - 1) / available;
+    auto passDeadline = now + state_->timeout * (rounds + 1);
+    // Replaces the worker of a node past its timeout, so that the rest of the pass
+    // keeps its workers; the pass gets one more timeout for the replacement.
+    auto replaceStuck = [&](boot_clock::time_point now) {
+        for (auto &job : jobs) {
+            if (job->done || job->stuck || !job->started || now - *job->started < state_->timeout)
+                continue;
+            job->stuck = true;
+            state_->stuck++;
+            if (state_->running < state_->maxThreads) {
+                state_->replacements++;
+                spawnWorkerLocked();
+                passDeadline += state_->timeout;
+            } else {
+                state_->degradedPasses++;
+                LOG(WARNING) << "No replacement for the worker stuck on " << job->path << ", "
+                             << state_->availableLocked() << " of " << state_->workers
+                             << " workers available";
+            }
+        }
+    };
+    while (batch->pending > 0) {
+        auto now = boot_clock::now();
+        replaceStuck(now);
+        if (now >= passDeadline)
+            break;
+        // A node past its timeout no longer holds up the others.
+        bool waiting = std::any_of(jobs.begin(), jobs.end(), [&](const auto &job) {
+            return !job->done && !job->stuck;
+        });
+        if (!waiting)
+            break;
+        batch->cv.wait_for(guard, std::min<boot_clock::duration>(state_->timeout / 4,
+                                                                 passDeadline - now));
+    }
+
+    now = boot_clock::now();
+    replaceStuck(now);
+    for (auto &job : jobs) {
+        if (job->done) {
+            if (job->result.ok)
+                state_->quarantine.erase(job->path);
+            results[job->path] = std::move(job->result);
+        } else if (job->stuck) {
+            state_->quarantineLocked(job->path, now);
+        } else if (!job->started) {
+            // Never picked up because the workers were tied up; not the node's fault.
+            job->cancelled = true;
+        }
+    }
+    return results;
+}
+
+std::string SysfsReadPool::dump() {
+    std::lock_guard<std::mutex> guard(state_->lock);
+    std::string out;
+    size_t available = state_->availableLocked();
+    StringAppendF(&out, "Sysfs read pool: %zu of %zu workers available%s (%zu busy, %zu stuck), "
+                  "%" PRIu64 " reads, %" PRIu64 " timeouts, %" PRIu64 " replacements, %" PRIu64
+                  " degraded\n",
+                  available, state_->workers, available < state_->workers ? ", degraded" : "",
+                  state_->busy, state_->stuck, state_->reads, state_->timeouts,
+                  state_->replacements, state_->degradedPasses);
+    auto now = boot_clock::now();
+    for (const auto &[path, entry] : state_->quarantine) {
+        StringAppendF(&out, "  %s: %" PRIu64 " timeouts, %s\n", path.c_str(), entry.timeouts,
+                      now < entry.until ? "quarantined" : "on probation");
+    }
+    return out;
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
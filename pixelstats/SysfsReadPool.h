@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_SYSFSREADPOOL_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_SYSFSREADPOOL_H
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+struct SysfsReadResult {
+    bool ok = false;
+    std::string content;
+};
+
+// Results of one collection pass, keyed by path.
+using SysfsReadResults = std::map<std::string, SysfsReadResult>;
+
+/**
+ * Reads independent sysfs nodes on a small pool of worker threads, so a node whose
+ * driver blocks on a lock or on firmware only delays itself. A node that does not
+ * complete within the timeout is reported as failed and quarantined with an
+ * exponential backoff, so further reads do not tie up more workers. Its worker stays
+ * blocked until the read returns and is replaced in the meantime, up to twice the
+ * configured number of threads; past that the pool runs degraded, which dump()
+ * reports. A replaced worker exits once its read returns.
+ */
+class SysfsReadPool {
+  public:
+    SysfsReadPool(size_t workers, std::chrono::milliseconds timeout);
+    // Stops and joins the workers. A worker still stuck in a read after the timeout
+    // is detached instead, as joining it could block forever.
+    ~SysfsReadPool();
+
+    SysfsReadResults readAll(const std::vector<std::string> &paths);
+    std::string dump();
+
+  private:
+    struct State;
+
+    // Requires State::lock.
+    void spawnWorkerLocked();
+
+    // Shared with the workers, so that a worker detached while stuck in a read can
+    // still finish it.
+    std::shared_ptr<State> state_;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_SYSFSREADPOOL_H
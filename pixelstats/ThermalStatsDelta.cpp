@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "ThermalStatsDelta.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <pixelstats/StatsHelper.h>
+
+#include <cstring>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+using android::base::boot_clock;
+using android::hardware::google::pixel::PixelAtoms::ReverseDomainNames;
+using Gs201Atoms::ThermalStatsDeltaReported;
+
+namespace {
+
+constexpr char kZonePrefix[] = "THERMAL ZONE:";
+constexpr char kBucketSeparator[] = "====>";
+
+// "/sys/devices/platform/100a0000.BIG/trip_counter" -> "BIG"
+std::string tripZoneName(const std::string &path) {
+    std::string dir = android::base::Basename(android::base::Dirname(path));
+    return dir.substr(dir.rfind('.') + 1);
+}
+
+// ".../tr_by_group/tmu/stats" -> "tmu"
+std::string residencyGroupName(const std::string &path) {
+    return android::base::Basename(android::base::Dirname(path));
+}
+
+}  // namespace
+
+ThermalStatsDelta::ThermalStatsDelta(std::vector<std::string> tripCounterPaths,
+                                     std::vector<std::string> residencyPaths)
+    : trip_counter_paths_(std::move(tripCounterPaths)),
+      residency_paths_(std::move(residencyPaths)) {}
+
+std::vector<std::string> ThermalStatsDelta::nodes() const {
+    std::vector<std::string> nodes = trip_counter_paths_;
+    nodes.insert(nodes.end(), residency_paths_.begin(), residency_paths_.end());
+    return nodes;
+}
+
+std::string ThermalStatsDelta::encodeDeltas(const std::vector<int64_t> &previous,
+                                            const std::vector<int64_t> &current) {
+    std::string encoded;
+    bool reset = previous.size() != current.size();
+    for (size_t i = 0; !reset && i < current.size(); i++)
+        reset = current[i] < previous[i];
+
+    for (size_t i = 0; i < current.size(); i++) {
+        int64_t delta = reset ? current[i] : current[i] - previous[i];
+        if (delta == 0)
+            continue;
+        if (!encoded.empty())
+            encoded += ',';
+        encoded += std::to_string(i) + ':' + std::to_string(delta);
+    }
+    return encoded;
+}
+
+std::string ThermalStatsDelta::update(const std::string &key, std::vector<int64_t> values,
+                                      int64_t *seconds) {
+    auto now = boot_clock::now();
+    auto it = snapshots_.find(key);
+    if (it == snapshots_.end()) {
+        // The first snapshot is the baseline; what happened before it is unknown.
+        snapshots_.emplace(key, Snapshot{std::move(values), now, "", 0});
+        return "";
+    }
+
+    Snapshot &snapshot = it->second;
+    std::string encoded = encodeDeltas(snapshot.values, values);
+    if (encoded.empty())
+        return "";
+
+    *seconds = std::chrono::duration_cast<std::chrono::seconds>(now - snapshot.time).count();
+    snapshot.values = std::move(values);
+    snapshot.time = now;
+    snapshot.deltas = encoded;
+    snapshot.seconds = *seconds;
+    return encoded;
+}
+
+void ThermalStatsDelta::reportDeltas(ThermalStatsDeltaReported::Source source,
+                                     const std::string &zone, int64_t seconds,
+                                     const std::string &deltas, std::vector<VendorAtom> *atoms) {
+    std::vector<VendorAtomValue> values(ThermalStatsDeltaReported::kDeltasFieldNumber -
+                                        kVendorAtomOffset + 1);
+    values[ThermalStatsDeltaReported::kSourceFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::intValue>(source);
+    values[ThermalStatsDeltaReported::kZoneFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(zone);
+    values[ThermalStatsDeltaReported::kIntervalSecondsFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::longValue>(seconds);
+    values[ThermalStatsDeltaReported::kDeltasFieldNumber - kVendorAtomOffset] =
+            VendorAtomValue::make<VendorAtomValue::stringValue>(deltas);
+    atoms->push_back({.reverseDomainName = ReverseDomainNames().pixel(),
+                      .atomId = Gs201Atoms::Atom::kThermalStatsDeltaReported,
+                      .values = std::move(values)});
+}
+
+void ThermalStatsDelta::collectTrips(const std::string &path, const std::string &content,
+                                     std::vector<VendorAtom> *atoms) {
+    std::vector<int64_t> counts;
+    for (const auto &token : android::base::Split(android::base::Trim(content), " \t\n")) {
+        int64_t count;
+        if (!token.empty() && android::base::ParseInt(token, &count))
+            counts.push_back(count);
+    }
+
+    int64_t seconds = 0;
+    std::string deltas = update(path, std::move(counts), &seconds);
+    if (!deltas.empty())
+        reportDeltas(ThermalStatsDeltaReported::TRIP_COUNTER, tripZoneName(path), seconds,
+                     deltas, atoms);
+}
+
+void ThermalStatsDelta::collectResidency(const std::string &path, const std::string &content,
+                                         std::vector<VendorAtom> *atoms) {
+    std::string zone;
+    std::vector<int64_t> buckets;
+
+    auto flushZone = [&]() {
+        if (zone.empty())
+            return;
+        int64_t seconds = 0;
+        std::string deltas = update(path + ":" + zone, std::move(buckets), &seconds);
+        if (!deltas.empty())
+            reportDeltas(ThermalStatsDeltaReported::TEMP_RESIDENCY,
+                         residencyGroupName(path) + "/" + zone, seconds, deltas, atoms);
+        buckets.clear();
+    };
+
+    for (const auto &rawLine : android::base::Split(content, "\n")) {
+        std::string line = android::base::Trim(rawLine);
+        if (android::base::StartsWith(line, kZonePrefix)) {
+            flushZone();
+            zone = android::base::Trim(line.substr(strlen(kZonePrefix)));
+        } else if (auto pos = line.find(kBucketSeparator); pos != std::string::npos) {
+            std::string value = android::base::Trim(line.substr(pos + strlen(kBucketSeparator)));
+            if (android::base::EndsWith(value, "ms"))
+                value.resize(value.size() - 2);
+            int64_t ms = 0;
+            android::base::ParseInt(value, &ms);
+            buckets.push_back(ms);
+        }
+    }
+    flushZone();
+}
+
+void ThermalStatsDelta::collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+    for (const auto &path : trip_counter_paths_) {
+        auto read = reads.find(path);
+        if (read != reads.end() && read->second.ok)
+            collectTrips(path, read->second.content, atoms);
+    }
+    for (const auto &path : residency_paths_) {
+        auto read = reads.find(path);
+        if (read != reads.end() && read->second.ok)
+            collectResidency(path, read->second.content, atoms);
+    }
+}
+
+std::string ThermalStatsDelta::dump() const {
+    std::string out = "Thermal deltas:\n";
+    for (const auto &path : trip_counter_paths_) {
+        auto it = snapshots_.find(path);
+        if (it != snapshots_.end() && !it->second.deltas.empty())
+            out += "  trips " + tripZoneName(path) + " in " + std::to_string(it->second.seconds) +
+                   "s: " + it->second.deltas + "\n";
+    }
+    for (const auto &[key, snapshot] : snapshots_) {
+        auto sep = key.find(':');
+        if (sep == std::string::npos || snapshot.deltas.empty())
+            continue;
+        out += "  residency " + residencyGroupName(key.substr(0, sep)) + "/" +
+               key.substr(sep + 1) + " in " + std::to_string(snapshot.seconds) +
+               "s: " + snapshot.deltas + "\n";
+    }
+    return out;
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_THERMALSTATSDELTA_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_THERMALSTATSDELTA_H
+
+#include <android-base/chrono_utils.h>
+#include <device/google/gs201/pixelstats/gs201_pixelatoms.pb.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "AtomReporter.h"
+#include "SysfsReadPool.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Owns the thermal trip counters and temperature residency stats, which the
+ * SysfsCollector no longer reads. Each collection reports the deltas against the
+ * previous snapshot kept in memory as ThermalStatsDeltaReported atoms: one per zone
+ * with a non-zero delta, encoding only its non-zero entries. The residency stats are
+ * never reset, so no samples are lost between a read and a reset; a counter that went
+ * backwards anyway counts from zero. The first snapshot after start is the baseline.
+ */
+class ThermalStatsDelta {
+  public:
+    ThermalStatsDelta(std::vector<std::string> tripCounterPaths,
+                      std::vector<std::string> residencyPaths);
+
+    std::vector<std::string> nodes() const;
+    void collect(const SysfsReadResults &reads, std::vector<VendorAtom> *atoms);
+    std::string dump() const;
+
+  private:
+    struct Snapshot {
+        std::vector<int64_t> values;
+        android::base::boot_clock::time_point time;
+        // The last non-zero delta and the interval it covered, for dump().
+        std::string deltas;
+        int64_t seconds;
+    };
+
+    // Returns the non-zero deltas against |previous| as "index:delta,..."; empty if
+    // nothing changed. A counter that went backwards was reset and counts from zero.
+    static std::string encodeDeltas(const std::vector<int64_t> &previous,
+                                     const std::vector<int64_t> &current);
+    void collectTrips(const std::string &path, const std::string &content,
+                      std::vector<VendorAtom> *atoms);
+    void collectResidency(const std::string &path, const std::string &content,
+                          std::vector<VendorAtom> *atoms);
+    // Updates |key|'s snapshot; returns the encoded deltas and the interval covered.
+    std::string update(const std::string &key, std::vector<int64_t> values, int64_t *seconds);
+    static void reportDeltas(Gs201Atoms::ThermalStatsDeltaReported::Source source,
+                             const std::string &zone, int64_t seconds,
+                             const std::string &deltas, std::vector<VendorAtom> *atoms);
+
+    const std::vector<std::string> trip_counter_paths_;
+    const std::vector<std::string> residency_paths_;
+    std::map<std::string, Snapshot> snapshots_;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_THERMALSTATSDELTA_H
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "pixelstats"
+
+#include "UeventTriggers.h"
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <cutils/uevent.h>
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+namespace {
+
+constexpr int kUeventBufferSize = 64 * 1024;
+constexpr size_t kUeventMsgLen = 2048;
+
+}  // namespace
+
+UeventTriggers::UeventTriggers(MetricScheduler *scheduler) : scheduler_(scheduler) {}
+
+void UeventTriggers::addTrigger(std::string header, std::vector<std::string> match,
+                                std::string group) {
+    triggers_.push_back({std::move(header), std::move(match), std::move(group)});
+}
+
+// Accepts a message if it starts with the header of any trigger. Each header is
+// compared in word, half-word and byte loads; a load past the end of a short message
+// drops it.
+void UeventTriggers::attachFilter() {
+    std::vector<sock_filter> program;
+    for (const auto &trigger : triggers_) {
+        std::vector<size_t> mismatches;
+        for (size_t offset = 0; offset < trigger.header.size();) {
+            size_t size = std::min<size_t>(trigger.header.size() - offset, 4);
+            if (size == 3)
+                size = 2;
+            uint32_t value = 0;
+            for (size_t i = 0; i < size; i++)
+                value = value << 8 | static_cast<uint8_t>(trigger.header[offset + i]);
+            uint16_t width = size == 4 ? BPF_W : size == 2 ? BPF_H : BPF_B;
+            program.push_back(BPF_STMT(BPF_LD | width | BPF_ABS, static_cast<uint32_t>(offset)));
+            mismatches.push_back(program.size());
+            program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, value, 0, 0));
+            offset += size;
+        }
+        program.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+        for (size_t jump : mismatches) {
+            size_t skip = program.size() - jump - 1;
+            if (skip > UINT8_MAX) {
+                LOG(WARNING) << "Uevent trigger header " << trigger.header
+                             << " is too long to filter, receiving every uevent";
+                return;
+            }
+            program[jump].jf = static_cast<uint8_t>(skip);
+        }
+    }
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+
+    sock_fprog filter = {static_cast<unsigned short>(program.size()), program.data()};
+    if (setsockopt(uevent_fd_, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0)
+        PLOG(WARNING) << "Unable to filter the uevent socket, receiving every uevent";
+}
+
+bool UeventTriggers::attach(EventLoop *loop) {
+    if (triggers_.empty())
+        return true;
+
+    uevent_fd_.reset(uevent_open_socket(kUeventBufferSize, true));
+    if (uevent_fd_ < 0) {
+        LOG(ERROR) << "Unable to open uevent socket";
+        return false;
+    }
+    // onUevent() still matches the fields, so the filter only saves wakeups.
+    attachFilter();
+    return loop->addFd(uevent_fd_, [this] { onUevent(); });
+}
+
+void UeventTriggers::onUevent() {
+    char msg[kUeventMsgLen + 2];
+    ssize_t len = uevent_kernel_multicast_recv(uevent_fd_, msg, kUeventMsgLen);
+    if (len <= 0 || len >= static_cast<ssize_t>(kUeventMsgLen))
+        return;
+    msg[len] = '\0';
+    msg[len + 1] = '\0';
+
+    std::vector<std::string_view> fields;
+    for (char *cp = msg; *cp; cp += strlen(cp) + 1)
+        fields.emplace_back(cp);
+    if (fields.empty())
+        return;
+
+    for (const auto &trigger : triggers_) {
+        bool matched = android::base::StartsWith(fields[0], trigger.header) &&
+                       std::all_of(trigger.match.begin(), trigger.match.end(),
+                                   [&](const std::string &prefix) {
+            return std::any_of(fields.begin(), fields.end(), [&](std::string_view field) {
+                return android::base::StartsWith(field, prefix);
+            });
+        });
+        if (matched)
+            scheduler_->runNow(trigger.group);
+    }
+}
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
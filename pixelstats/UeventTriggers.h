@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_GOOGLE_GS201_PIXELSTATS_UEVENTTRIGGERS_H
+#define DEVICE_GOOGLE_GS201_PIXELSTATS_UEVENTTRIGGERS_H
+
+#include <android-base/unique_fd.h>
+
+#include <string>
+#include <vector>
+
+#include "EventLoop.h"
+#include "MetricScheduler.h"
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace pixel {
+namespace gs201 {
+
+/**
+ * Listens for uevents on the event loop and runs a metric group right away when a
+ * uevent says its metrics changed, instead of waiting for its next period. The socket
+ * carries a kernel filter built from the trigger headers, so other uevents do not
+ * wake the loop.
+ */
+class UeventTriggers {
+  public:
+    explicit UeventTriggers(MetricScheduler *scheduler);
+
+    // Runs |group| on a uevent whose "<action>@<devpath>" header starts with |header|
+    // and that contains every string in |match| as a field prefix, e.g.
+    // "change@/devices/virtual/thermal/" and {"SUBSYSTEM=thermal", "TRIP="}.
+    void addTrigger(std::string header, std::vector<std::string> match, std::string group);
+    bool attach(EventLoop *loop);
+
+  private:
+    struct Trigger {
+        std::string header;
+        std::vector<std::string> match;
+        std::string group;
+    };
+
+    void attachFilter();
+    void onUevent();
+
+    MetricScheduler *const scheduler_;
+    android::base::unique_fd uevent_fd_;
+    std::vector<Trigger> triggers_;
+};
+
+}  // namespace gs201
+}  // namespace pixel
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
+
+#endif  // DEVICE_GOOGLE_GS201_PIXELSTATS_UEVENTTRIGGERS_H
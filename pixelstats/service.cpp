@@ -17,6 +17,10 @@
 #define LOG_TAG "pixelstats"
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <device/google/gs201/pixelstats/gs201_pixelatoms.pb.h>
+#include <pixelstats/StatsHelper.h>
 #include <pixelstats/SysfsCollector.h>
 #include <pixelstats/UeventListener.h>
 
@@ -25,12 +29,87 @@
 #include <pixelstats/SysfsCollector.h>
 #include <pixelstats/UeventListener.h>
 
+#include "AtomReporter.h"
+#include "AtomSpool.h"
+#include "BatteryEepromReader.h"
+#include "EventLoop.h"
+#include "F2fsDeltaStats.h"
+#include "IrqLatencyAnalyzer.h"
+#include "MetricScheduler.h"
+#include "PcieLinkTracker.h"
+#include "ResumeLatencyTracker.h"
+#include "SysfsReadPool.h"
+#include "ThermalStatsDelta.h"
+#include "UeventTriggers.h"
+
 using android::hardware::google::pixel::SysfsCollector;
+using android::hardware::google::pixel::PixelAtoms::ReverseDomainNames;
 using android::hardware::google::pixel::UeventListener;
+using android::hardware::google::pixel::gs201::AtomReporter;
+using android::hardware::google::pixel::gs201::AtomSpool;
+using android::hardware::google::pixel::gs201::BatteryEepromReader;
+using android::hardware::google::pixel::gs201::EventLoop;
+using android::hardware::google::pixel::gs201::F2fsDeltaStats;
+using android::hardware::google::pixel::gs201::IrqLatencyAnalyzer;
+using android::hardware::google::pixel::gs201::MetricGroup;
+using android::hardware::google::pixel::gs201::MetricScheduler;
+using android::hardware::google::pixel::gs201::PcieLinkTracker;
+using android::hardware::google::pixel::gs201::ResumeLatencyTracker;
+using android::hardware::google::pixel::gs201::SysfsReadPool;
+using android::hardware::google::pixel::gs201::SysfsReadResults;
+using android::hardware::google::pixel::gs201::ThermalStatsDelta;
+using android::hardware::google::pixel::gs201::UeventTriggers;
+using android::hardware::google::pixel::gs201::VendorAtom;
+using android::hardware::google::pixel::gs201::VendorAtomValue;
+namespace Gs201Atoms = android::hardware::google::pixel::gs201::Gs201Atoms;
+
+using namespace std::chrono_literals;
+
+// Read by the gs201 thermal group, which reports deltas instead of the full counters
+// and never resets the residency stats.
+const std::vector<std::string> kThermalTripCounterPaths = {
+    "/sys/devices/platform/100a0000.BIG/trip_counter",
+    "/sys/devices/platform/100a0000.MID/trip_counter",
+    "/sys/devices/platform/100a0000.LITTLE/trip_counter",
+    "/sys/devices/platform/100b0000.G3D/trip_counter",
+    "/sys/devices/platform/100b0000.TPU/trip_counter",
+    "/sys/devices/platform/100b0000.AUR/trip_counter",
+};
+const std::vector<std::string> kTempResidencyPaths = {
+    "/sys/kernel/metrics/thermal/tr_by_group/tmu/stats",
+    "/sys/kernel/metrics/thermal/tr_by_group/spmic/stats",
+};
+
+// Read and reset daily by the gs201 IRQ latency group.
+constexpr char kLongIRQMetricsPath[] = "/sys/kernel/metrics/irq/long_irq_metrics";
+constexpr char kStormIRQMetricsPath[] = "/sys/kernel/metrics/irq/storm_irq_metrics";
+constexpr char kIRQStatsResetPath[] = "/sys/kernel/metrics/irq/stats_reset";
+
+// Read incrementally by the gs201 battery EEPROM group instead of in full.
+constexpr char kEEPROMPath[] = "/dev/battery_history";
+
+// Read daily by the gs201 resume latency group, which reports a sketch of the resumes
+// instead of the raw buckets. Resumes this slow or slower are counted as breaches; on
+// a kernel bucket edge.
+constexpr char kResumeLatencyMetricsPath[] =
+        "/sys/kernel/metrics/resume_latency/resume_latency_metrics";
+constexpr int64_t kResumeLatencyBreachMs = 100;
 
 #define BLOCK_STATS_LENGTH 17
 #define UFSHC_PATH(filename) "/dev/sys/block/bootdevice/" #filename
 #define UFS_ERR_PATH(err_type) UFSHC_PATH(err_stats/) #err_type
+// Read daily by the gs201 UFS error group, in the field order of UfsErrorStatsReported.
+// err_stats reads go through the UFS host driver and can stall behind it, so they are
+// left to the read pool.
+const std::vector<std::string> kUFSErrStatsPaths = {
+    UFS_ERR_PATH(pa_err_count),
+    UFS_ERR_PATH(dl_err_count),
+    UFS_ERR_PATH(nl_err_count),
+    UFS_ERR_PATH(tl_err_count),
+    UFS_ERR_PATH(dme_err_count),
+    UFS_ERR_PATH(fatal_err_count),
+    UFS_ERR_PATH(auto_hibern8_err_count),
+};
 const struct SysfsCollector::SysfsPaths sysfs_paths = {
     .SlowioReadCntPath = UFSHC_PATH(slowio_read_cnt),
     .SlowioWriteCntPath = UFSHC_PATH(slowio_write_cnt),
@@ -43,7 +122,6 @@ const struct SysfsCollector::SysfsPaths sysfs_paths = {
     .F2fsStatsPath = "/sys/fs/f2fs/",
     .ImpedancePath = "/sys/devices/platform/audiometrics/speaker_impedance",
     .CodecPath =     "/sys/devices/platform/audiometrics/codec_state",
-    .EEPROMPath = "/dev/battery_history",
     .MitigationPath = "/sys/devices/virtual/pmic/mitigation",
     .MitigationDurationPath = "/sys/devices/virtual/pmic/mitigation/irq_dur_cnt",
     .BrownoutReasonProp = "vendor.brownout_reason",
@@ -51,43 +129,10 @@ const struct SysfsCollector::SysfsPaths sysfs_paths = {
     .SpeakerTemperaturePath = "/sys/devices/platform/audiometrics/speaker_temp",
     .SpeakerExcursionPath = "/sys/devices/platform/audiometrics/speaker_excursion",
     .SpeakerHeartBeatPath = "/sys/devices/platform/audiometrics/speaker_heartbeat",
-    .UFSErrStatsPath = {
-        UFS_ERR_PATH(pa_err_count),
-        UFS_ERR_PATH(dl_err_count),
-        UFS_ERR_PATH(nl_err_count),
-        UFS_ERR_PATH(tl_err_count),
-        UFS_ERR_PATH(dme_err_count),
-        UFS_ERR_PATH(fatal_err_count),
-        UFS_ERR_PATH(auto_hibern8_err_count)
-    },
     .BlockStatsLength = BLOCK_STATS_LENGTH,
     .AmsRatePath = "/sys/devices/platform/audiometrics/ams_rate_read_once",
     .MitigationPath = "/sys/devices/virtual/pmic/mitigation",
-    .ThermalStatsPaths = {
-        "/sys/devices/platform/100a0000.BIG/trip_counter",
-        "/sys/devices/platform/100a0000.MID/trip_counter",
-        "/sys/devices/platform/100a0000.LITTLE/trip_counter",
-        "/sys/devices/platform/100b0000.G3D/trip_counter",
-        "/sys/devices/platform/100b0000.TPU/trip_counter",
-        "/sys/devices/platform/100b0000.AUR/trip_counter",
-    },
     .CCARatePath = "/sys/devices/platform/audiometrics/cca_count_read_once",
-    .TempResidencyAndResetPaths = {
-        {
-            "/sys/kernel/metrics/thermal/tr_by_group/tmu/stats",
-            "/sys/kernel/metrics/thermal/tr_by_group/tmu/stats_reset"
-        },
-        {
-            "/sys/kernel/metrics/thermal/tr_by_group/spmic/stats",
-            "/sys/kernel/metrics/thermal/tr_by_group/spmic/stats_reset"
-        }
-    },
-    .ResumeLatencyMetricsPath = "/sys/kernel/metrics/resume_latency/resume_latency_metrics",
-    .LongIRQMetricsPath = "/sys/kernel/metrics/irq/long_irq_metrics",
-    .StormIRQMetricsPath = "/sys/kernel/metrics/irq/storm_irq_metrics",
-    .IRQStatsResetPath = "/sys/kernel/metrics/irq/stats_reset",
-    .ModemPcieLinkStatsPath = "/sys/devices/platform/11920000.pcie/link_stats",
-    .WifiPcieLinkStatsPath = "/sys/devices/platform/14520000.pcie/link_stats",
     .GMSRPath = "/sys/class/power_supply/maxfg/gmsr",
     .TotalCallCountPath = "/sys/devices/platform/audiometrics/call_count"
 };
@@ -96,6 +141,149 @@ const struct UeventListener::UeventPaths ueventPaths = {
         .AudioUevent = "/devices/virtual/amcs/amcs",
         .TypeCPartnerUevent = "PRODUCT_TYPE="};
 
+// gs201 metric groups run next to the SysfsCollector, whose daily pass cannot be
+// split from here. A node read by a group is left out of sysfs_paths, so that it has
+// one owner. Groups run hourly or daily, so that the jitter folds them into one hourly
+// wakeup. Their atoms are defined in gs201_pixelatoms.proto, and every pass that has
+// atoms to report delivers the spooled ones first.
+static void addMetricGroups(MetricScheduler *scheduler, SysfsReadPool *readPool,
+                            AtomReporter *reporter, UeventTriggers *triggers) {
+    static ThermalStatsDelta thermalStats(kThermalTripCounterPaths, kTempResidencyPaths);
+    scheduler->addGroup({
+        .name = "thermal",
+        .period = 1h,
+        .jitter = 10min,
+        .priority = 10,
+        .nodes = thermalStats.nodes(),
+        .collect = [](const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+            thermalStats.collect(reads, atoms);
+        },
+    });
+    // Thermal zones under the user_space governor report trip crossings.
+    triggers->addTrigger("change@/devices/virtual/thermal/", {"SUBSYSTEM=thermal", "TRIP="},
+                         "thermal");
+
+    static IrqLatencyAnalyzer irqLatency(kLongIRQMetricsPath, kStormIRQMetricsPath,
+                                         kIRQStatsResetPath);
+    scheduler->addGroup({
+        .name = "irq_latency",
+        .period = 24h,
+        .jitter = 1h,
+        .priority = 20,
+        .nodes = irqLatency.nodes(),
+        .collect = [](const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+            irqLatency.collect(reads, atoms);
+        },
+    });
+
+    static ResumeLatencyTracker resumeLatency(kResumeLatencyMetricsPath, kResumeLatencyBreachMs,
+                                              "/data/vendor/pixelstats/resume_latency");
+    scheduler->addGroup({
+        .name = "resume_latency",
+        .period = 24h,
+        .jitter = 1h,
+        .priority = 30,
+        .nodes = resumeLatency.nodes(),
+        .collect = [](const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+            resumeLatency.collect(reads, atoms);
+        },
+    });
+
+    // The counts are reported as they are, since boot, so a restart needs no state.
+    scheduler->addGroup({
+        .name = "ufs_errors",
+        .period = 24h,
+        .jitter = 1h,
+        .priority = 35,
+        .nodes = kUFSErrStatsPaths,
+        .collect = [](const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+            std::vector<VendorAtomValue> values;
+            for (const auto &path : kUFSErrStatsPaths) {
+                auto read = reads.find(path);
+                int64_t count;
+                if (read == reads.end() || !read->second.ok ||
+                    !android::base::ParseInt(android::base::Trim(read->second.content), &count))
+                    return;
+                values.push_back(VendorAtomValue::make<VendorAtomValue::longValue>(count));
+            }
+            atoms->push_back({.reverseDomainName = ReverseDomainNames().pixel(),
+                              .atomId = Gs201Atoms::Atom::kUfsErrorStatsReported,
+                              .values = std::move(values)});
+        },
+    });
+
+    static BatteryEepromReader batteryEeprom(kEEPROMPath,
+                                             "/data/vendor/pixelstats/battery_eeprom_checkpoint",
+                                             "/data/vendor/pixelstats/battery_eeprom_new");
+    scheduler->addGroup({
+        .name = "battery_eeprom",
+        .period = 24h,
+        .jitter = 1h,
+        .priority = 40,
+        .collect = [](const SysfsReadResults &, std::vector<VendorAtom> *) {
+            batteryEeprom.collect();
+        },
+    });
+
+    // fs_mgr links the f2fs sysfs directory of /data here. F2fsStatsPath stays with the
+    // SysfsCollector, which reports several atoms from that directory that no group
+    // replaces, so the GC and checkpoint counters are the one set of nodes read twice.
+    static F2fsDeltaStats f2fsStats("/dev/sys/fs/by-name/userdata");
+    scheduler->addGroup({
+        .name = "f2fs",
+        .period = 1h,
+        .jitter = 10min,
+        .priority = 50,
+        .nodes = f2fsStats.nodes(),
+        .collect = [](const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+            f2fsStats.collect(reads, atoms);
+        },
+    });
+
+    static PcieLinkTracker modemPcie("modem", "/sys/devices/platform/11920000.pcie/link_stats",
+                                     "/sys/devices/platform/11920000.pcie/power_stats");
+    static PcieLinkTracker wifiPcie("wifi", "/sys/devices/platform/14520000.pcie/link_stats",
+                                    "/sys/devices/platform/14520000.pcie/power_stats");
+    std::vector<std::string> pcieNodes = modemPcie.nodes();
+    for (auto &node : wifiPcie.nodes())
+        pcieNodes.push_back(node);
+    scheduler->addGroup({
+        .name = "pcie_links",
+        .period = 1h,
+        .jitter = 10min,
+        .priority = 60,
+        .nodes = pcieNodes,
+        .collect = [](const SysfsReadResults &reads, std::vector<VendorAtom> *atoms) {
+            modemPcie.collect(reads, atoms);
+            wifiPcie.collect(reads, atoms);
+        },
+    });
+    scheduler->addGroup({
+        .name = "pcie_links_digest",
+        .period = 24h,
+        .jitter = 1h,
+        .priority = 61,
+        .collect = [](const SysfsReadResults &, std::vector<VendorAtom> *atoms) {
+            modemPcie.reportDigest(atoms);
+            wifiPcie.reportDigest(atoms);
+        },
+    });
+
+    scheduler->addGroup({
+        .name = "scheduler",
+        .period = 24h,
+        .jitter = 1h,
+        .priority = 100,
+        .collect = [scheduler, readPool, reporter](const SysfsReadResults &,
+                                                   std::vector<VendorAtom> *) {
+            LOG(INFO) << scheduler->dump() << readPool->dump() << reporter->dump()
+                      << thermalStats.dump() << irqLatency.dump() << resumeLatency.dump()
+                      << batteryEeprom.dump() << f2fsStats.dump() << modemPcie.dump()
+                      << wifiPcie.dump();
+        },
+    });
+}
+
 int main() {
     LOG(INFO) << "starting PixelStats";
 
@@ -103,6 +291,27 @@ int main() {
     std::thread listenThread(&UeventListener::ListenForever, &ueventListener);
     listenThread.detach();
 
+    // The libpixelstats listener and collector block in their own loops on a socket
+    // and a timer they do not expose, so the gs201 metric groups get an event loop
+    // and thread of their own. It lives as long as the collector below.
+
+    // Drivers behind some nodes take locks or query firmware; a stuck node gets
+    // quarantined instead of delaying the rest of the pass, and its worker replaced.
+    SysfsReadPool readPool(2, 500ms);
+    // Holds atoms that IStats did not accept, e.g. while statsd restarts.
+    AtomSpool spool("/data/vendor/pixelstats/atom_spool");
+    AtomReporter reporter(&spool);
+    MetricScheduler scheduler(&readPool, &reporter);
+    UeventTriggers triggers(&scheduler);
+    addMetricGroups(&scheduler, &readPool, &reporter, &triggers);
+
+    EventLoop loop;
+    loop.addFd(scheduler.timerFd(), [&scheduler] { scheduler.onTimer(); });
+    triggers.attach(&loop);
+    scheduler.start();
+    std::thread metricsThread(&EventLoop::run, &loop);
+    metricsThread.detach();
+
     SysfsCollector collector(sysfs_paths);
     collector.collect();  // This blocks forever.
 
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host-side decoder for the atom spool written by pixelstats.
+//
+//   adb pull /data/vendor/pixelstats/atom_spool
+//   atom_spool_decode atom_spool
+//
+// Prints the undelivered atoms from oldest to newest, one per line:
+//   real_time_ms domain atom_id [values]
+// The atom ids and the order of the values are those of gs201_pixelatoms.proto, the
+// values starting at field 2.
+// Decoding stops at the first record that fails its CRC.
+
+#include <stdio.h>
+
+#include <cinttypes>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "AtomSpoolFormat.h"
+
+using namespace android::hardware::google::pixel::gs201;
+
+namespace {
+
+class Ring {
+  public:
+    explicit Ring(const std::vector<uint8_t> &data) : data_(data) {}
+
+    void copyOut(uint64_t offset, void *dst, size_t len) const {
+        for (size_t i = 0; i < len; i++)
+            static_cast<uint8_t *>(dst)[i] =
+                    data_[kAtomSpoolPageSize + (offset + i) % kAtomSpoolCapacity];
+    }
+
+  private:
+    const std::vector<uint8_t> &data_;
+};
+
+class Reader {
+  public:
+    explicit Reader(const std::vector<uint8_t> &data) : data_(data) {}
+
+    template <typename T>
+    bool get(T *value) {
+        if (data_.size() - pos_ < sizeof(T))
+            return false;
+        memcpy(value, data_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool getString(std::string *str) {
+        uint16_t len;
+        if (!get(&len) || data_.size() - pos_ < len)
+            return false;
+        str->assign(reinterpret_cast<const char *>(data_.data() + pos_), len);
+        pos_ += len;
+        return true;
+    }
+
+  private:
+    const std::vector<uint8_t> &data_;
+    size_t pos_ = 0;
+};
+
+bool printAtom(const std::vector<uint8_t> &payload) {
+    Reader reader(payload);
+    std::string domain;
+    int32_t atomId;
+    uint16_t count;
+    if (!reader.getString(&domain) || !reader.get(&atomId) || !reader.get(&count))
+        return false;
+
+    std::string values;
+    for (uint16_t i = 0; i < count; i++) {
+        if (i > 0)
+            values += ", ";
+        uint8_t tag;
+        if (!reader.get(&tag))
+            return false;
+        switch (tag) {
+            case kAtomSpoolInt: {
+                int32_t v;
+                if (!reader.get(&v))
+                    return false;
+                values += std::to_string(v);
+                break;
+            }
+            case kAtomSpoolLong: {
+                int64_t v;
+                if (!reader.get(&v))
+                    return false;
+                values += std::to_string(v);
+                break;
+            }
+            case kAtomSpoolFloat: {
+                float v;
+                if (!reader.get(&v))
+                    return false;
+                values += std::to_string(v);
+                break;
+            }
+            case kAtomSpoolBool: {
+                uint8_t v;
+                if (!reader.get(&v))
+                    return false;
+                values += v ? "true" : "false";
+                break;
+            }
+            case kAtomSpoolString: {
+                std::string v;
+                if (!reader.getString(&v))
+                    return false;
+                values += "\"" + v + "\"";
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    printf(" %s %d [%s]\n", domain.c_str(), atomId, values.c_str());
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <atom_spool>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == nullptr) {
+        perror(argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> data(kAtomSpoolFileSize);
+    size_t len = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+    if (len != data.size()) {
+        fprintf(stderr, "%s: expected %zu bytes, read %zu\n", argv[1], data.size(), len);
+        return 1;
+    }
+
+    AtomSpoolHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != kAtomSpoolMagic || header.version != kAtomSpoolVersion ||
+        header.capacity != kAtomSpoolCapacity) {
+        fprintf(stderr, "%s: not a version %u atom spool\n", argv[1], kAtomSpoolVersion);
+        return 1;
+    }
+    if (header.crc != atomSpoolHeaderCrc(header))
+        fprintf(stderr, "warning: header checksum mismatch\n");
+    if (header.tail < header.head || header.tail - header.head > kAtomSpoolCapacity) {
+        fprintf(stderr, "%s: invalid ring offsets %" PRIu64 "..%" PRIu64 "\n", argv[1],
+                header.head, header.tail);
+        return 1;
+    }
+
+    printf("# spooled=%" PRIu64 " delivered=%" PRIu64 " dropped=%" PRIu64
+           " pending_bytes=%" PRIu64 "\n",
+           header.spooled, header.delivered, header.dropped, header.tail - header.head);
+
+    Ring ring(data);
+    std::vector<uint8_t> payload;
+    size_t records = 0;
+    uint64_t offset = header.head;
+    while (offset < header.tail) {
+        AtomSpoolRecordHeader record;
+        if (header.tail - offset < sizeof(record))
+            break;
+        ring.copyOut(offset, &record, sizeof(record));
+        if (record.length > kAtomSpoolMaxPayload ||
+            header.tail - offset - sizeof(record) < record.length)
+            break;
+        payload.resize(record.length);
+        ring.copyOut(offset + sizeof(record), payload.data(), record.length);
+        if (record.crc != atomSpoolRecordCrc(record, payload.data()))
+            break;
+        printf("%" PRId64, record.real_time_ms);
+        if (!printAtom(payload))
+            printf(" <undecodable>\n");
+        records++;
+        offset += sizeof(record) + record.length;
+    }
+    if (offset < header.tail)
+        fprintf(stderr, "warning: %" PRIu64 " bytes after record %zu are corrupt\n",
+                header.tail - offset, records);
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StageStats.h"
+
+#include <cutils/trace.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace gs201 {
+
+// Bucket i holds samples below 500us << i; the last one is open ended.
+static constexpr int kBuckets = 14;
+static constexpr int64_t kFirstBucketLimitUs = 500;
+
+void StageWindow::add(std::chrono::microseconds duration) {
+    mSamplesUs[mNext] = duration.count();
+    mNext = (mNext + 1) % kWindowSize;
+    mCount = std::min(mCount + 1, kWindowSize);
+}
+
+void StageWindow::dump(int fd, const char *indent, const char *name) const {
+    if (mCount == 0)
+        return;
+
+    std::vector<int64_t> samples(mSamplesUs.begin(), mSamplesUs.begin() + mCount);
+    std::sort(samples.begin(), samples.end());
+
+    int buckets[kBuckets] = {0};
+    for (int64_t us : samples) {
+        int bucket = 0;
+        while (bucket < kBuckets - 1 && us >= (kFirstBucketLimitUs << bucket))
+            bucket++;
+        buckets[bucket]++;
+    }
+
+    dprintf(fd, "%s%-16s n=%-3d p50=%.1fms p95=%.1fms max=%.1fms [", indent, name, mCount,
+            samples[samples.size() / 2] / 1000.0, samples[samples.size() * 95 / 100] / 1000.0,
+            samples.back() / 1000.0);
+    for (int i = 0; i < kBuckets; i++)
+        dprintf(fd, i ? " %d" : "%d", buckets[i]);
+    dprintf(fd, "]\n");
+}
+
+const char *StageWindow::bucketLegend() {
+    return "buckets in ms: <0.5 <1 <2 ... <2048 >=2048";
+}
+
+ScopedStageTimer::ScopedStageTimer(uint64_t traceTag, const char *name)
+    : mTraceTag(traceTag), mStart(std::chrono::steady_clock::now()) {
+    atrace_begin(mTraceTag, name);
+}
+
+ScopedStageTimer::~ScopedStageTimer() {
+    atrace_end(mTraceTag);
+}
+
+std::chrono::microseconds ScopedStageTimer::elapsed() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                 mStart);
+}
+
+}  // namespace gs201
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace android {
+namespace hardware {
+namespace google {
+namespace gs201 {
+
+/*
+ * StageWindow keeps the last kWindowSize durations of one stage of an operation and
+ * prints their percentiles with a log2 histogram. It does no locking; the owner
+ * serializes add() and dump().
+ */
+class StageWindow {
+  public:
+    static constexpr int kWindowSize = 64;
+
+    void add(std::chrono::microseconds duration);
+    int count() const { return mCount; }
+    // Prints |name| with the sample count, p50, p95 and max, and the bucket counts.
+    void dump(int fd, const char *indent, const char *name) const;
+
+    // Describes the histogram buckets, for the header of a dump.
+    static const char *bucketLegend();
+
+  private:
+    std::array<int64_t, kWindowSize> mSamplesUs = {};
+    int mCount = 0;
+    int mNext = 0;
+};
+
+/*
+ * Emits an atrace span named |name| under |traceTag| for the lifetime of the object
+ * and measures it. Owners record elapsed() before it goes out of scope.
+ */
+class ScopedStageTimer {
+  public:
+    ScopedStageTimer(uint64_t traceTag, const char *name);
+    ~ScopedStageTimer();
+
+    ScopedStageTimer(const ScopedStageTimer &) = delete;
+    ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+    std::chrono::microseconds elapsed() const;
+
+  private:
+    const uint64_t mTraceTag;
+    const std::chrono::steady_clock::time_point mStart;
+};
+
+}  // namespace gs201
+}  // namespace google
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.gadget.aidl-service.UsbFunctionTuning"
+
+#include "UsbFunctionTuning.h"
+
+#include <aidl/android/hardware/usb/gadget/GadgetFunction.h>
+#include <android-base/file.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace gadget {
+
+using ::aidl::android::hardware::usb::gadget::GadgetFunction;
+using ::android::base::WriteStringToFile;
+
+struct TuningAttribute {
+    // Gadget function the attribute belongs to.
+    long function;
+    // Attribute path relative to FUNCTIONS_PATH.
+    const char *attribute;
+    const char *value;
+};
+
+struct TuningProfile {
+    // Lowest negotiated speed the profile is used for.
+    UsbSpeed speed;
+    std::vector<TuningAttribute> attributes;
+};
+
+/*
+ * Profiles, ordered by speed. The profile used is the last one whose speed does not exceed
+ * the negotiated speed of the current data session; an unknown speed, e.g. the first bind
+ * after a cable attach, selects the high-speed profile.
+ *
+ * qmult scales the NCM request queue depth at high-speed and above. The NTB sizes are
+ * negotiated by the host through SetNtbInputSize and are not exposed by configfs.
+ *
+ * f_uvc derives both the high-speed and the super-speed streaming endpoint from the same
+ * attributes: a maxpacket above 1024 is split into 1024 byte transactions per interval,
+ * and maxburst only exists in the super-speed companion descriptor. Every profile lists
+ * all three attributes so that a profile change overrides the previous one.
+ *  - high-speed: three 1024 byte transactions every microframe, the most a high-speed
+ *    isochronous endpoint can carry (24 MB/s).
+ *  - super-speed: bursts of 16 packets of 1024 bytes every 125us (131 MB/s). Hosts
+ *    handle long bursts better than the multiple bursts per interval a larger
+ *    maxpacket would need.
+ */
+static const std::vector<TuningProfile> kTuningProfiles = {
+    {UsbSpeed::HIGHSPEED,
+     {
+         {GadgetFunction::NCM, "ncm.gs9/qmult", "5"},
+         {GadgetFunction::UVC, "uvc.0/streaming_maxpacket", "3072"},
+         {GadgetFunction::UVC, "uvc.0/streaming_maxburst", "0"},
+         {GadgetFunction::UVC, "uvc.0/streaming_interval", "1"},
+     }},
+    {UsbSpeed::SUPERSPEED,
+     {
+         {GadgetFunction::NCM, "ncm.gs9/qmult", "10"},
+         {GadgetFunction::UVC, "uvc.0/streaming_maxpacket", "1024"},
+         {GadgetFunction::UVC, "uvc.0/streaming_maxburst", "15"},
+         {GadgetFunction::UVC, "uvc.0/streaming_interval", "1"},
+     }},
+};
+
+static int selectProfile(UsbSpeed speed) {
+    int profile = 0;
+
+    if (speed == UsbSpeed::UNKNOWN)
+        return 0;
+
+    for (int i = 0; i < (int)kTuningProfiles.size(); i++) {
+        if (static_cast<int>(kTuningProfiles[i].speed) <= static_cast<int>(speed))
+            profile = i;
+    }
+    return profile;
+}
+
+UsbFunctionTuning::UsbFunctionTuning() : mAppliedProfile(-1) {}
+
+bool UsbFunctionTuning::isTunable(long functions) {
+    return (functions & (GadgetFunction::NCM | GadgetFunction::UVC)) != 0;
+}
+
+bool UsbFunctionTuning::isProfileStale(UsbSpeed speed) {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mAppliedProfile != -1 && mAppliedProfile != selectProfile(speed);
+}
+
+void UsbFunctionTuning::apply(long functions, UsbSpeed speed) {
+    std::lock_guard<std::mutex> lock(mLock);
+    int profile = selectProfile(speed);
+
+    for (const auto &attr : kTuningProfiles[profile].attributes) {
+        if ((functions & attr.function) == 0)
+            continue;
+
+        std::string path = std::string(FUNCTIONS_PATH) + attr.attribute;
+        auto it = mApplied.find(path);
+        if (it != mApplied.end() && it->second == attr.value)
+            continue;
+
+        // Older kernels might not expose every attribute.
+        if (access(path.c_str(), W_OK) != 0)
+            continue;
+
+        if (!WriteStringToFile(attr.value, path)) {
+            ALOGE("Unable to write %s to %s", attr.value, path.c_str());
+            continue;
+        }
+        mApplied[path] = attr.value;
+    }
+
+    if (profile != mAppliedProfile)
+        ALOGI("Applied usb function tuning profile %d", profile);
+    mAppliedProfile = profile;
+}
+
+}  // namespace gadget
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
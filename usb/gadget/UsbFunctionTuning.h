@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <aidl/android/hardware/usb/gadget/UsbSpeed.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace gadget {
+
+using ::aidl::android::hardware::usb::gadget::UsbSpeed;
+
+#ifndef FUNCTIONS_PATH
+#define FUNCTIONS_PATH "/config/usb_gadget/g1/functions/"
+#endif
+
+/*
+ * UsbFunctionTuning applies per-speed configfs attributes (queue depths, UVC streaming
+ * endpoint parameters) to the NCM and UVC functions. The profiles are described by a
+ * table in UsbFunctionTuning.cpp. Function attributes are latched by the kernel when the
+ * gadget binds, so a profile has to be applied before pullup; UsbGadget re-binds the
+ * functions when the negotiated speed selects another profile.
+ */
+class UsbFunctionTuning {
+  public:
+    UsbFunctionTuning();
+
+    // Writes the profile for |speed| to the functions in |functions| that are tunable.
+    void apply(long functions, UsbSpeed speed);
+    // Returns true if |speed| selects a different profile than the one last applied.
+    bool isProfileStale(UsbSpeed speed);
+    // Returns true if |functions| include one that the profiles tune.
+    static bool isTunable(long functions);
+
+  private:
+    // Protects mApplied and mAppliedProfile.
+    std::mutex mLock;
+    // Last value successfully written to each attribute.
+    std::map<std::string, std::string> mApplied;
+    int mAppliedProfile;
+};
+
+}  // namespace gadget
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
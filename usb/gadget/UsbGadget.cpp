@@ -19,13 +19,20 @@
 #include "UsbGadget.h"
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/inotify.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <functional>
+#include <vector>
+
 #include <android-base/properties.h>
 
 #include <aidl/android/frameworks/stats/IStats.h>
@@ -36,6 +43,7 @@ namespace hardware {
 namespace usb {
 namespace gadget {
 
+using ::android::base::EqualsIgnoreCase;
 using ::android::base::GetBoolProperty;
 using ::android::hardware::google::pixel::usb::kUvcEnabled;
 
@@ -45,6 +53,33 @@ constexpr char kI2CPath[] = "/sys/devices/platform/10d60000.hsi2c/i2c-";
 constexpr char kAccessoryLimitCurrent[] = "i2c-max77759tcpc/usb_limit_accessory_current";
 constexpr char kAccessoryLimitCurrentEnable[] = "i2c-max77759tcpc/usb_limit_accessory_enable";
 constexpr char kUpdateSdpEnumTimeout[] = "i2c-max77759tcpc/update_sdp_enum_timeout";
+constexpr char kConfigfsConfigPath[] = "/config/usb_gadget/g1/configs/b.1/";
+constexpr char kConfigfsIdVendorPath[] = "/config/usb_gadget/g1/idVendor";
+constexpr char kConfigfsIdProductPath[] = "/config/usb_gadget/g1/idProduct";
+// Shortest time between two re-binds for a tuning profile change.
+constexpr std::chrono::seconds kTuningRebindHoldoff(5);
+
+// Function instances created by init.gs201.usb.rc and the gadget function they implement.
+static const std::pair<const char *, long> kConfigfsFunctions[] = {
+    {"ffs.adb", GadgetFunction::ADB},
+    {"ffs.mtp", GadgetFunction::MTP},
+    {"mtp.gs0", GadgetFunction::MTP},
+    {"ffs.ptp", GadgetFunction::PTP},
+    {"ptp.gs1", GadgetFunction::PTP},
+    {"accessory.gs2", GadgetFunction::ACCESSORY},
+    {"audio_source.gs3", GadgetFunction::AUDIO_SOURCE},
+    {"rndis.gs4", GadgetFunction::RNDIS},
+    {"midi.gs5", GadgetFunction::MIDI},
+    {"ncm.gs9", GadgetFunction::NCM},
+    {"uvc.0", GadgetFunction::UVC},
+};
+
+// Vendor debug function instances and the vendor functions config that links them.
+static const std::pair<const char *, const char *> kConfigfsVendorFunctions[] = {
+    {"dm.gs7", "dm"},
+    {"etr_miu.gs11", "etr_miu"},
+    {"acm.uwb0", "uwb_acm"},
+};
 
 Status getI2cBusHelper(string *name) {
     DIR *dp;
@@ -69,11 +104,43 @@ Status getI2cBusHelper(string *name) {
     return Status::ERROR;
 }
 
-UsbGadget::UsbGadget() : mGadgetIrqPath("") {
+UsbGadget::UsbGadget()
+    : mGadgetIrqPath(""),
+      mCurrentUsbFunctions(GadgetFunction::NONE),
+      mCurrentUsbFunctionsApplied(false),
+      mUsbSpeed(UsbSpeed::UNKNOWN),
+      mUsbSpeedMonitor(UDC_STATE_PATH, SPEED_PATH,
+                       [this](UsbSpeed speed) { onUsbSpeedChanged(speed); },
+                       [this](const std::string &state) { onUdcStateChanged(state); }),
+      mStopRequestThread(false) {
     if (access(OS_DESC_PATH, R_OK) != 0) {
         ALOGE("configfs setup not done yet");
         abort();
     }
+
+    mPullUpEventFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (mPullUpEventFd.get() == -1) {
+        ALOGE("eventfd failed: %s", strerror(errno));
+        abort();
+    }
+
+    adoptConfigfsState();
+
+    mRequestThread = std::thread(&UsbGadget::requestThread, this);
+    // The callbacks need the members above.
+    mUsbSpeedMonitor.start();
+}
+
+UsbGadget::~UsbGadget() {
+    mUsbSpeedMonitor.stop();
+    {
+        std::lock_guard<std::mutex> lock(mRequestLock);
+        mStopRequestThread = true;
+    }
+    mRequestCv.notify_one();
+    wakePullUpWait();
+    if (mRequestThread.joinable())
+        mRequestThread.join();
 }
 
 Status UsbGadget::getUsbGadgetIrqPath() {
@@ -118,10 +185,125 @@ Status UsbGadget::getUsbGadgetIrqPath() {
     return Status::SUCCESS;
 }
 
+static Status resolveVidPid(uint64_t functions,
+                            const std::function<Status(const char *, const char *)> &apply);
+
 void currentFunctionsAppliedCallback(bool functionsApplied, void *payload) {
     UsbGadget *gadget = (UsbGadget *)payload;
     gadget->mCurrentUsbFunctionsApplied = functionsApplied;
     gadget->updateSdpEnumTimeout();
+    if (functionsApplied)
+        gadget->wakePullUpWait();
+}
+
+void UsbGadget::wakePullUpWait() {
+    if (eventfd_write(mPullUpEventFd.get(), 1))
+        ALOGE("eventfd_write failed: %s", strerror(errno));
+}
+
+void UsbGadget::adoptConfigfsState() {
+    AdoptedGadgetState state = {GadgetFunction::NONE, "", "", ""};
+    std::vector<std::string> ffsInstances;
+    std::string udc;
+    DIR *dp;
+
+    // Nothing to adopt unless a previous instance left the gadget pulled up.
+    if (!ReadFileToString(PULLUP_PATH, &udc) || Trim(udc) != kGadgetName)
+        return;
+
+    dp = opendir(kConfigfsConfigPath);
+    if (dp == NULL) {
+        ALOGE("Failed to open %s", kConfigfsConfigPath);
+        return;
+    }
+
+    struct dirent *ep;
+    while ((ep = readdir(dp))) {
+        char target[PATH_MAX];
+        std::string link = string(kConfigfsConfigPath) + ep->d_name;
+
+        if (ep->d_type != DT_LNK)
+            continue;
+
+        ssize_t len = readlink(link.c_str(), target, sizeof(target) - 1);
+        if (len <= 0)
+            continue;
+        target[len] = '\0';
+
+        const char *instance = strrchr(target, '/');
+        instance = instance ? instance + 1 : target;
+
+        for (const auto &[name, function] : kConfigfsFunctions) {
+            if (!strcmp(instance, name))
+                state.functions |= function;
+        }
+        if (!strncmp(instance, "ffs.", strlen("ffs.")))
+            ffsInstances.push_back(instance);
+        for (const auto &[name, vendorFunctions] : kConfigfsVendorFunctions) {
+            if (!strcmp(instance, name))
+                state.vendorFunctions = vendorFunctions;
+        }
+    }
+    closedir(dp);
+
+    if (state.functions == GadgetFunction::NONE)
+        return;
+
+    if (ReadFileToString(kConfigfsIdVendorPath, &state.vid))
+        state.vid = Trim(state.vid);
+    if (ReadFileToString(kConfigfsIdProductPath, &state.pid))
+        state.pid = Trim(state.pid);
+
+    ALOGI("Adopting configfs gadget functions:%ld vendor:%s vid:%s pid:%s", state.functions,
+          state.vendorFunctions.c_str(), state.vid.c_str(), state.pid.c_str());
+
+    mCurrentUsbFunctions = state.functions;
+    mCurrentUsbFunctionsApplied = true;
+    // The next switch starts from the adopted functions, not from none.
+    mSwitchStats.setAppliedFunctions(state.functions);
+
+    // Re-attach the ffs monitor so that a restart of adbd or the mtp/ptp daemon is still
+    // followed by a pulldown and pullup of the gadget.
+    for (const auto &instance : ffsInstances) {
+        std::string ffsPath = "/dev/usb-ffs/" + instance.substr(strlen("ffs.")) + "/";
+        monitorFfs.addInotifyFd(ffsPath);
+        monitorFfs.addEndPoint(ffsPath + "ep1");
+        monitorFfs.addEndPoint(ffsPath + "ep2");
+    }
+    if (!ffsInstances.empty()) {
+        monitorFfs.registerFunctionsAppliedCallback(&currentFunctionsAppliedCallback, this);
+        monitorFfs.startMonitor();
+    }
+
+    mAdoptedState = state;
+}
+
+bool UsbGadget::matchesAdoptedState(long functions) {
+    std::string udc;
+    std::optional<AdoptedGadgetState> state = std::move(mAdoptedState);
+
+    mAdoptedState.reset();
+    if (!state || state->functions != functions)
+        return false;
+
+    std::string vendorFunctions = getVendorFunctions();
+    if (vendorFunctions == "user")
+        vendorFunctions = "";
+    if (vendorFunctions != state->vendorFunctions)
+        return false;
+
+    // A gadget left with the same functions but another vid/pid still needs a switch.
+    std::string vid, pid;
+    if (resolveVidPid(functions, [&vid, &pid](const char *resolvedVid, const char *resolvedPid) {
+            vid = resolvedVid;
+            pid = resolvedPid;
+            return Status::SUCCESS;
+        }) != Status::SUCCESS)
+        return false;
+    if (!EqualsIgnoreCase(vid, state->vid) || !EqualsIgnoreCase(pid, state->pid))
+        return false;
+
+    return ReadFileToString(PULLUP_PATH, &udc) && Trim(udc) == kGadgetName;
 }
 
 ScopedAStatus UsbGadget::getCurrentUsbFunctions(const shared_ptr<IUsbGadgetCallback> &callback,
@@ -136,33 +318,50 @@ ScopedAStatus UsbGadget::getCurrentUsbFunctions(const shared_ptr<IUsbGadgetCallb
     return ScopedAStatus::ok();
 }
 
+void UsbGadget::onUsbSpeedChanged(UsbSpeed speed) {
+    mUsbSpeed = speed;
+
+    // Function attributes are latched at bind time, so the current functions are bound
+    // again to pick up the profile of the new speed.
+    long functions = mCurrentUsbFunctions;
+    if (speed == UsbSpeed::UNKNOWN || !mCurrentUsbFunctionsApplied ||
+        !UsbFunctionTuning::isTunable(functions) || !mUsbFunctionTuning.isProfileStale(speed))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mRequestLock);
+        // A pending request applies the new profile anyway.
+        if (mPendingRequest || mStopRequestThread)
+            return;
+        // A marginal cable can keep flipping between speeds; don't follow it with a
+        // re-enumeration every time.
+        auto now = std::chrono::steady_clock::now();
+        if (now - mLastTuningRebind < kTuningRebindHoldoff) {
+            ALOGW("USB function tuning profile for %s not applied, re-bound recently",
+                  UsbSpeedMonitor::usbSpeedToString(speed));
+            return;
+        }
+        mLastTuningRebind = now;
+        mPendingRequest = FunctionsRequest{functions, nullptr, 0, 0, speed};
+    }
+    ALOGI("Re-binding USB functions %ld for the %s tuning profile", functions,
+          UsbSpeedMonitor::usbSpeedToString(speed));
+    mRequestCv.notify_one();
+}
+
+void UsbGadget::onUdcStateChanged(const std::string &state) {
+    if (state == "configured")
+        mSwitchStats.onConfigured();
+}
+
 ScopedAStatus UsbGadget::getUsbSpeed(const shared_ptr<IUsbGadgetCallback> &callback,
         int64_t in_transactionId) {
-    std::string current_speed;
-    if (ReadFileToString(SPEED_PATH, &current_speed)) {
-        current_speed = Trim(current_speed);
-        ALOGI("current USB speed is %s", current_speed.c_str());
-        if (current_speed == "low-speed")
-            mUsbSpeed = UsbSpeed::LOWSPEED;
-        else if (current_speed == "full-speed")
-            mUsbSpeed = UsbSpeed::FULLSPEED;
-        else if (current_speed == "high-speed")
-            mUsbSpeed = UsbSpeed::HIGHSPEED;
-        else if (current_speed == "super-speed")
-            mUsbSpeed = UsbSpeed::SUPERSPEED;
-        else if (current_speed == "super-speed-plus")
-            mUsbSpeed = UsbSpeed::SUPERSPEED_10Gb;
-        else if (current_speed == "UNKNOWN")
-            mUsbSpeed = UsbSpeed::UNKNOWN;
-        else
-            mUsbSpeed = UsbSpeed::UNKNOWN;
-    } else {
-        ALOGE("Fail to read current speed");
-        mUsbSpeed = UsbSpeed::UNKNOWN;
-    }
+    UsbSpeed speed = mUsbSpeedMonitor.getUsbSpeed();
+    mUsbSpeed = speed;
+    ALOGI("current USB speed is %s", UsbSpeedMonitor::usbSpeedToString(speed));
 
     if (callback) {
-        ScopedAStatus ret = callback->getUsbSpeedCb(mUsbSpeed, in_transactionId);
+        ScopedAStatus ret = callback->getUsbSpeedCb(speed, in_transactionId);
 
         if (!ret.isOk())
             ALOGE("Call to getUsbSpeedCb failed %s", ret.getDescription().c_str());
@@ -184,7 +383,9 @@ Status UsbGadget::tearDownGadget() {
     return Status::SUCCESS;
 }
 
-static Status validateAndSetVidPid(uint64_t functions) {
+// Resolves the vid and pid for |functions| and passes them to |apply|.
+static Status resolveVidPid(uint64_t functions,
+                            const std::function<Status(const char *, const char *)> &apply) {
     Status ret = Status::SUCCESS;
     std::string vendorFunctions = getVendorFunctions();
 
@@ -194,7 +395,7 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4ee1"));
+                ret = apply("0x18d1", "0x4ee1");
             }
             break;
         case GadgetFunction::ADB |
@@ -203,7 +404,7 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4ee2"));
+                ret = apply("0x18d1", "0x4ee2");
             }
             break;
         case GadgetFunction::RNDIS:
@@ -213,7 +414,7 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4ee3"));
+                ret = apply("0x18d1", "0x4ee3");
             }
             break;
         case GadgetFunction::ADB |
@@ -222,13 +423,13 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 GadgetFunction::RNDIS |
                 GadgetFunction::NCM:
             if (vendorFunctions == "dm") {
-                ret = Status(setVidPid("0x04e8", "0x6862"));
+                ret = apply("0x04e8", "0x6862");
             } else {
                 if (!(vendorFunctions == "user" || vendorFunctions == "")) {
                     ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                     ret = Status::CONFIGURATION_NOT_SUPPORTED;
                 } else {
-                    ret = Status(setVidPid("0x18d1", "0x4ee4"));
+                    ret = apply("0x18d1", "0x4ee4");
                 }
             }
             break;
@@ -237,7 +438,7 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4ee5"));
+                ret = apply("0x18d1", "0x4ee5");
             }
             break;
         case GadgetFunction::ADB |
@@ -246,22 +447,22 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4ee6"));
+                ret = apply("0x18d1", "0x4ee6");
             }
             break;
         case GadgetFunction::ADB:
             if (vendorFunctions == "dm") {
-                ret = Status(setVidPid("0x04e8", "0x6862"));
+                ret = apply("0x04e8", "0x6862");
             } else if (vendorFunctions == "etr_miu") {
-                ret = Status(setVidPid("0x18d1", "0x4ee2"));
+                ret = apply("0x18d1", "0x4ee2");
             } else if (vendorFunctions == "uwb_acm"){
-                ret = Status(setVidPid("0x18d1", "0x4ee2"));
+                ret = apply("0x18d1", "0x4ee2");
             } else {
                 if (!(vendorFunctions == "user" || vendorFunctions == "")) {
                     ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                     ret = Status::CONFIGURATION_NOT_SUPPORTED;
                 } else {
-                    ret = Status(setVidPid("0x18d1", "0x4ee7"));
+                    ret = apply("0x18d1", "0x4ee7");
                 }
             }
             break;
@@ -270,7 +471,7 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4ee8"));
+                ret = apply("0x18d1", "0x4ee8");
             }
             break;
         case GadgetFunction::ADB |
@@ -279,57 +480,57 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4ee9"));
+                ret = apply("0x18d1", "0x4ee9");
             }
             break;
         case GadgetFunction::ACCESSORY:
             if (!(vendorFunctions == "user" || vendorFunctions == ""))
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-            ret = Status(setVidPid("0x18d1", "0x2d00"));
+            ret = apply("0x18d1", "0x2d00");
             break;
         case GadgetFunction::ADB |
                  GadgetFunction::ACCESSORY:
             if (!(vendorFunctions == "user" || vendorFunctions == ""))
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-            ret = Status(setVidPid("0x18d1", "0x2d01"));
+            ret = apply("0x18d1", "0x2d01");
             break;
         case GadgetFunction::AUDIO_SOURCE:
             if (!(vendorFunctions == "user" || vendorFunctions == ""))
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-            ret = Status(setVidPid("0x18d1", "0x2d02"));
+            ret = apply("0x18d1", "0x2d02");
             break;
         case GadgetFunction::ADB |
                 GadgetFunction::AUDIO_SOURCE:
             if (!(vendorFunctions == "user" || vendorFunctions == ""))
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-            ret = Status(setVidPid("0x18d1", "0x2d03"));
+            ret = apply("0x18d1", "0x2d03");
             break;
         case GadgetFunction::ACCESSORY |
                 GadgetFunction::AUDIO_SOURCE:
             if (!(vendorFunctions == "user" || vendorFunctions == ""))
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-            ret = Status(setVidPid("0x18d1", "0x2d04"));
+            ret = apply("0x18d1", "0x2d04");
             break;
         case GadgetFunction::ADB |
                 GadgetFunction::ACCESSORY |
                 GadgetFunction::AUDIO_SOURCE:
             if (!(vendorFunctions == "user" || vendorFunctions == ""))
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-            ret = Status(setVidPid("0x18d1", "0x2d05"));
+            ret = apply("0x18d1", "0x2d05");
             break;
         case GadgetFunction::NCM:
             if (!(vendorFunctions == "user" || vendorFunctions == ""))
                 ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-            ret = Status(setVidPid("0x18d1", "0x4eeb"));
+            ret = apply("0x18d1", "0x4eeb");
             break;
         case GadgetFunction::ADB |
                 GadgetFunction::NCM:
             if (vendorFunctions == "dm") {
-                ret = Status(setVidPid("0x04e8", "0x6862"));
+                ret = apply("0x04e8", "0x6862");
             } else {
                 if (!(vendorFunctions == "user" || vendorFunctions == ""))
                     ALOGE("Invalid vendorFunctions set: %s", vendorFunctions.c_str());
-                ret = Status(setVidPid("0x18d1", "0x4eec"));
+                ret = apply("0x18d1", "0x4eec");
             }
             break;
         case GadgetFunction::UVC:
@@ -340,7 +541,7 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("UVC function not enabled by config");
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4eed"));
+                ret = apply("0x18d1", "0x4eed");
             }
             break;
         case GadgetFunction::ADB | GadgetFunction::UVC:
@@ -351,7 +552,7 @@ static Status validateAndSetVidPid(uint64_t functions) {
                 ALOGE("UVC function not enabled by config");
                 ret = Status::CONFIGURATION_NOT_SUPPORTED;
             } else {
-                ret = Status(setVidPid("0x18d1", "0x4eee"));
+                ret = apply("0x18d1", "0x4eee");
             }
             break;
         default:
@@ -361,6 +562,12 @@ static Status validateAndSetVidPid(uint64_t functions) {
     return ret;
 }
 
+static Status validateAndSetVidPid(uint64_t functions) {
+    return resolveVidPid(functions, [](const char *vid, const char *pid) {
+        return Status(setVidPid(vid, pid));
+    });
+}
+
 ScopedAStatus UsbGadget::reset(const shared_ptr<IUsbGadgetCallback> &callback,
         int64_t in_transactionId) {
     ALOGI("USB Gadget reset");
@@ -388,6 +595,27 @@ ScopedAStatus UsbGadget::reset(const shared_ptr<IUsbGadgetCallback> &callback,
     return ScopedAStatus::ok();
 }
 
+binder_status_t UsbGadget::dump(int fd, const char ** /* args */, uint32_t /* numArgs */) {
+    dprintf(fd, "Current functions: %ld (%s)\n", mCurrentUsbFunctions.load(),
+            mCurrentUsbFunctionsApplied ? "applied" : "not applied");
+    dprintf(fd, "Current speed: %s\n",
+            UsbSpeedMonitor::usbSpeedToString(mUsbSpeedMonitor.getUsbSpeed()));
+
+    std::vector<UsbSpeedMonitor::SpeedDowngrade> downgrades =
+            mUsbSpeedMonitor.getSpeedDowngrades();
+    dprintf(fd, "Speed downgrades in this session: %zu\n", downgrades.size());
+    for (const auto &downgrade : downgrades) {
+        dprintf(fd, "  %lldms since boot: %s -> %s\n",
+                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                        downgrade.timestamp.time_since_epoch()).count(),
+                UsbSpeedMonitor::usbSpeedToString(downgrade.from),
+                UsbSpeedMonitor::usbSpeedToString(downgrade.to));
+    }
+
+    mSwitchStats.dump(fd);
+    return STATUS_OK;
+}
+
 void UsbGadget::updateSdpEnumTimeout() {
     string i2c_node, update_sdp_enum_timeout_path;
 
@@ -406,9 +634,15 @@ void UsbGadget::updateSdpEnumTimeout() {
 
 Status UsbGadget::setupFunctions(long functions,
         const shared_ptr<IUsbGadgetCallback> &callback, uint64_t timeout,
-        int64_t in_transactionId) {
+        int64_t in_transactionId, UsbSpeed tuningSpeed) {
     bool ffsEnabled = false;
     int i = 0;
+    std::optional<ScopedSwitchStage> linkStage;
+
+    linkStage.emplace(&mSwitchStats, UsbSwitchStats::LINK_FUNCTIONS);
+
+    // Apply the speed profile before the functions are linked and bound.
+    mUsbFunctionTuning.apply(functions, tuningSpeed);
 
     if (Status(addGenericAndroidFunctions(&monitorFfs, functions, &ffsEnabled, &i)) !=
         Status::SUCCESS)
@@ -455,10 +689,14 @@ Status UsbGadget::setupFunctions(long functions,
             return Status::ERROR;
     }
 
+    linkStage.reset();
+    ScopedSwitchStage pullupStage(&mSwitchStats, UsbSwitchStats::PULLUP);
+
     // Pull up the gadget right away when there are no ffs functions.
     if (!ffsEnabled) {
         if (!WriteStringToFile(kGadgetName, PULLUP_PATH))
             return Status::ERROR;
+        mCurrentUsbFunctions = functions;
         mCurrentUsbFunctionsApplied = true;
         if (callback)
             callback->setCurrentUsbFunctionsCb(functions, Status::SUCCESS, in_transactionId);
@@ -466,6 +704,10 @@ Status UsbGadget::setupFunctions(long functions,
         return Status::SUCCESS;
     }
 
+    // Drop wakeups left over from an earlier switch before the monitor can pull up.
+    eventfd_t stale;
+    eventfd_read(mPullUpEventFd.get(), &stale);
+
     monitorFfs.registerFunctionsAppliedCallback(&currentFunctionsAppliedCallback, this);
     // Monitors the ffs paths to pull up the gadget when descriptors are written.
     // Also takes of the pulling up the gadget again if the userspace process
@@ -475,71 +717,209 @@ Status UsbGadget::setupFunctions(long functions,
     if (kDebug)
         ALOGI("Mainthread in Cv");
 
-    if (callback) {
-        bool pullup = monitorFfs.waitForPullUp(timeout);
-        ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(
-            functions, pullup ? Status::SUCCESS : Status::ERROR, in_transactionId);
-        if (!ret.isOk()) {
-            ALOGE("setCurrentUsbFunctionsCb error %s", ret.getDescription().c_str());
-            return Status::ERROR;
-        }
+    if (!callback) {
+        mCurrentUsbFunctions = functions;
+        return Status::SUCCESS;
+    }
+
+    PullUpWait wait = waitForPullUp(timeout);
+    if (wait == PullUpWait::SUPERSEDED) {
+        ALOGI("setCurrentUsbFunctions %ld superseded while waiting for pullup", functions);
+        notifyRequestSuperseded({functions, callback, static_cast<int64_t>(timeout),
+                                 in_transactionId});
+        return Status::FUNCTIONS_NOT_APPLIED;
+    }
+
+    mCurrentUsbFunctions = functions;
+    ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(
+        functions, wait == PullUpWait::PULLED_UP ? Status::SUCCESS : Status::ERROR,
+        in_transactionId);
+    if (!ret.isOk()) {
+        ALOGE("setCurrentUsbFunctionsCb error %s", ret.getDescription().c_str());
+        return Status::ERROR;
     }
     return Status::SUCCESS;
 }
 
+UsbGadget::PullUpWait UsbGadget::waitForPullUp(uint64_t timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    // The monitor callback and newer requests signal mPullUpEventFd, so this sleeps
+    // until one of them or the deadline instead of polling.
+    while (true) {
+        if (mCurrentUsbFunctionsApplied)
+            return PullUpWait::PULLED_UP;
+        if (isRequestSuperseded())
+            return PullUpWait::SUPERSEDED;
+
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+            ALOGE("Timed out waiting for the gadget pullup");
+            return PullUpWait::TIMED_OUT;
+        }
+
+        struct pollfd pfd = {.fd = mPullUpEventFd.get(), .events = POLLIN};
+        int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, remaining.count()));
+        if (ret < 0) {
+            ALOGE("poll failed: %s", strerror(errno));
+            return PullUpWait::TIMED_OUT;
+        }
+        if (ret > 0) {
+            eventfd_t count;
+            eventfd_read(mPullUpEventFd.get(), &count);
+        }
+    }
+}
+
 ScopedAStatus UsbGadget::setCurrentUsbFunctions(long functions,
                                                const shared_ptr<IUsbGadgetCallback> &callback,
                                                int64_t timeout,
                                                int64_t in_transactionId) {
+    std::optional<FunctionsRequest> superseded;
+
+    {
+        std::lock_guard<std::mutex> lock(mRequestLock);
+        if (mPendingRequest)
+            superseded = std::move(mPendingRequest);
+        mPendingRequest = FunctionsRequest{functions, callback, timeout, in_transactionId};
+    }
+    mRequestCv.notify_one();
+    wakePullUpWait();
+
+    if (superseded) {
+        ALOGI("setCurrentUsbFunctions %ld superseded before being applied",
+              superseded->functions);
+        notifyRequestSuperseded(*superseded);
+    }
+
+    return ScopedAStatus::ok();
+}
+
+bool UsbGadget::isRequestSuperseded() {
+    std::lock_guard<std::mutex> lock(mRequestLock);
+    return mPendingRequest.has_value() || mStopRequestThread;
+}
+
+void UsbGadget::notifyRequestSuperseded(const FunctionsRequest &request) {
+    if (request.callback == NULL)
+        return;
+
+    ScopedAStatus ret = request.callback->setCurrentUsbFunctionsCb(
+        request.functions, Status::FUNCTIONS_NOT_APPLIED, request.transactionId);
+    if (!ret.isOk())
+        ALOGE("Error while calling setCurrentUsbFunctionsCb %s", ret.getDescription().c_str());
+}
+
+void UsbGadget::requestThread() {
+    while (true) {
+        FunctionsRequest request;
+
+        {
+            std::unique_lock<std::mutex> lock(mRequestLock);
+            mRequestCv.wait(lock, [this] { return mPendingRequest || mStopRequestThread; });
+            if (mStopRequestThread)
+                return;
+            request = std::move(*mPendingRequest);
+            mPendingRequest.reset();
+        }
+
+        applyUsbFunctions(request);
+    }
+}
+
+void UsbGadget::applyUsbFunctions(const FunctionsRequest &request) {
     std::unique_lock<std::mutex> lk(mLockSetCurrentFunction);
+    const long functions = request.functions;
+    const shared_ptr<IUsbGadgetCallback> &callback = request.callback;
     std::string current_usb_power_operation_mode, current_usb_type;
     std::string usb_limit_sink_enable;
 
     string accessoryCurrentLimitEnablePath, accessoryCurrentLimitPath, path;
 
-    mCurrentUsbFunctions = functions;
-    mCurrentUsbFunctionsApplied = false;
-
     getI2cBusHelper(&path);
     accessoryCurrentLimitPath = kI2CPath + path + "/" + kAccessoryLimitCurrent;
     accessoryCurrentLimitEnablePath = kI2CPath + path + "/" + kAccessoryLimitCurrentEnable;
 
+    // The gadget left up by a previous instance already runs these functions.
+    if (request.rebindSpeed == UsbSpeed::UNKNOWN && matchesAdoptedState(functions)) {
+        ALOGI("Usb Gadget functions %ld already applied, skipping re-enumeration", functions);
+        mCurrentUsbFunctions = functions;
+        mCurrentUsbFunctionsApplied = true;
+        if (callback == NULL)
+            return;
+        ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(functions, Status::SUCCESS,
+                                                               request.transactionId);
+        if (!ret.isOk())
+            ALOGE("Error while calling setCurrentUsbFunctionsCb %s", ret.getDescription().c_str());
+        return;
+    }
+
     // Get the gadget IRQ number before tearDownGadget()
     if (mGadgetIrqPath.empty())
         getUsbGadgetIrqPath();
 
+    mSwitchStats.beginSwitch(functions);
+
     // Unlink the gadget and stop the monitor if running.
-    Status status = tearDownGadget();
+    Status status;
+    {
+        ScopedSwitchStage stage(&mSwitchStats, UsbSwitchStats::TEARDOWN);
+        status = tearDownGadget();
+    }
     if (status != Status::SUCCESS) {
         goto error;
     }
 
     ALOGI("Returned from tearDown gadget");
+    mCurrentUsbFunctionsApplied = false;
 
     // Leave the gadget pulled down to give time for the host to sense disconnect.
-    usleep(kDisconnectWaitUs);
+    {
+        ScopedSwitchStage stage(&mSwitchStats, UsbSwitchStats::DISCONNECT_WAIT);
+        usleep(kDisconnectWaitUs);
+    }
+
+    // A newer request arrived while tearing down; leave the gadget down for it.
+    if (isRequestSuperseded()) {
+        ALOGI("setCurrentUsbFunctions %ld superseded during teardown", functions);
+        notifyRequestSuperseded(request);
+        return;
+    }
 
     if (functions == GadgetFunction::NONE) {
+        mCurrentUsbFunctions = functions;
+        mSwitchStats.endSwitch();
         if (callback == NULL)
-            return ScopedAStatus::fromServiceSpecificErrorWithMessage(
-                -1, "callback == NULL");
-        ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(functions, Status::SUCCESS, in_transactionId);
+            return;
+        ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(functions, Status::SUCCESS,
+                                                               request.transactionId);
         if (!ret.isOk())
             ALOGE("Error while calling setCurrentUsbFunctionsCb %s", ret.getDescription().c_str());
-        return ScopedAStatus::fromServiceSpecificErrorWithMessage(
-                -1, "Error while calling setCurrentUsbFunctionsCb");
+        return;
     }
 
-    status = validateAndSetVidPid(functions);
+    {
+        ScopedSwitchStage stage(&mSwitchStats, UsbSwitchStats::VID_PID);
+        status = validateAndSetVidPid(functions);
+    }
 
     if (status != Status::SUCCESS) {
         goto error;
     }
 
-    status = setupFunctions(functions, callback, timeout, in_transactionId);
+    // A re-bind ends the data session it was queued for, so it carries the speed to tune for.
+    status = setupFunctions(functions, callback, request.timeout, request.transactionId,
+                            request.rebindSpeed != UsbSpeed::UNKNOWN
+                                    ? request.rebindSpeed
+                                    : mUsbSpeedMonitor.getSessionUsbSpeed());
+    // A newer request replaces this one; the caller has already been told.
+    if (status == Status::FUNCTIONS_NOT_APPLIED)
+        return;
     if (status != Status::SUCCESS) {
         goto error;
     }
+    mSwitchStats.endSwitch();
 
     if (functions & GadgetFunction::NCM) {
         if (!mGadgetIrqPath.empty()) {
@@ -576,18 +956,16 @@ ScopedAStatus UsbGadget::setCurrentUsbFunctions(long functions,
     }
 
     ALOGI("Usb Gadget setcurrent functions called successfully");
-    return ScopedAStatus::ok();
+    return;
 
 error:
     ALOGI("Usb Gadget setcurrent functions failed");
     if (callback == NULL)
-        return ScopedAStatus::fromServiceSpecificErrorWithMessage(
-                -1, "Usb Gadget setcurrent functions failed");
-    ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(functions, status, in_transactionId);
+        return;
+    ScopedAStatus ret = callback->setCurrentUsbFunctionsCb(functions, status,
+                                                           request.transactionId);
     if (!ret.isOk())
         ALOGE("Error while calling setCurrentUsbFunctionsCb %s", ret.getDescription().c_str());
-    return ScopedAStatus::fromServiceSpecificErrorWithMessage(
-                -1, "Error while calling setCurrentUsbFunctionsCb");
 }
 }  // namespace gadget
 }  // namespace usb
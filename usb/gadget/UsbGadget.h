@@ -31,12 +31,18 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <utils/Log.h>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 
+#include "UsbFunctionTuning.h"
+#include "UsbSpeedMonitor.h"
+#include "UsbSwitchStats.h"
+
 namespace aidl {
 namespace android {
 namespace hardware {
@@ -79,6 +85,7 @@ constexpr char kSmpAffinityList[] = "/smp_affinity_list";
 static MonitorFfs monitorFfs(kGadgetName);
 
 #define SPEED_PATH UDC_PATH "current_speed"
+#define UDC_STATE_PATH UDC_PATH "state"
 
 #define BIG_CORE "6"
 #define MEDIUM_CORE "4"
@@ -92,13 +99,21 @@ static MonitorFfs monitorFfs(kGadgetName);
 
 struct UsbGadget : public BnUsbGadget {
     UsbGadget();
+    ~UsbGadget();
 
     // Makes sure that only one request is processed at a time.
     std::mutex mLockSetCurrentFunction;
     std::string mGadgetIrqPath;
-    long mCurrentUsbFunctions;
-    bool mCurrentUsbFunctionsApplied;
-    UsbSpeed mUsbSpeed;
+    // Written by the request and monitor threads, read from binder threads.
+    std::atomic<long> mCurrentUsbFunctions;
+    std::atomic<bool> mCurrentUsbFunctionsApplied;
+    std::atomic<UsbSpeed> mUsbSpeed;
+    // Per-stage latency of function switches, printed by dump().
+    UsbSwitchStats mSwitchStats;
+    // Per-speed NCM and UVC function parameters applied before pullup.
+    UsbFunctionTuning mUsbFunctionTuning;
+    // Caches the negotiated speed and records downgrades within a data session.
+    UsbSpeedMonitor mUsbSpeedMonitor;
 
     ScopedAStatus setCurrentUsbFunctions(long functions,
             const shared_ptr<IUsbGadgetCallback> &callback,
@@ -115,15 +130,69 @@ struct UsbGadget : public BnUsbGadget {
 
     ScopedAStatus setVidPid(const char *vid,const char *pid);
 
+    binder_status_t dump(int fd, const char **args, uint32_t numArgs) override;
+
     // Indicates to the kernel that the gadget service is ready and the kernel can
     // set SDP timeout to a lower value.
     void updateSdpEnumTimeout();
 
+    // Wakes a request waiting for the ffs pullup.
+    void wakePullUpWait();
+
   private:
+    // A setCurrentUsbFunctions request waiting to be applied by mRequestThread.
+    struct FunctionsRequest {
+        long functions;
+        shared_ptr<IUsbGadgetCallback> callback;
+        int64_t timeout;
+        int64_t transactionId;
+        // Set when the current functions are bound again for the tuning profile of this
+        // speed, see onUsbSpeedChanged(). Such a request never matches the adopted state.
+        UsbSpeed rebindSpeed = UsbSpeed::UNKNOWN;
+    };
+
+    // Gadget configuration found in configfs when the service started.
+    struct AdoptedGadgetState {
+        long functions;
+        std::string vendorFunctions;
+        std::string vid;
+        std::string pid;
+    };
+
+    enum class PullUpWait {
+        PULLED_UP,
+        TIMED_OUT,
+        // A newer request arrived or the service is stopping.
+        SUPERSEDED,
+    };
+
+    void adoptConfigfsState();
+    bool matchesAdoptedState(long functions);
     Status tearDownGadget();
     Status getUsbGadgetIrqPath();
     Status setupFunctions(long functions, const shared_ptr<IUsbGadgetCallback> &callback,
-            uint64_t timeout, int64_t in_transactionId);
+            uint64_t timeout, int64_t in_transactionId, UsbSpeed tuningSpeed);
+    PullUpWait waitForPullUp(uint64_t timeoutMs);
+    void applyUsbFunctions(const FunctionsRequest &request);
+    void requestThread();
+    bool isRequestSuperseded();
+    void notifyRequestSuperseded(const FunctionsRequest &request);
+    void onUsbSpeedChanged(UsbSpeed speed);
+    void onUdcStateChanged(const std::string &state);
+
+    // Protects mPendingRequest, mStopRequestThread and mLastTuningRebind.
+    std::mutex mRequestLock;
+    std::condition_variable mRequestCv;
+    // Only the most recent request is kept; older pending ones are superseded.
+    std::optional<FunctionsRequest> mPendingRequest;
+    bool mStopRequestThread;
+    // When onUsbSpeedChanged() last queued a re-bind.
+    std::chrono::steady_clock::time_point mLastTuningRebind;
+    std::thread mRequestThread;
+    // Signalled on pullup and when a request is superseded, see waitForPullUp().
+    unique_fd mPullUpEventFd;
+    // Consumed by the first setCurrentUsbFunctions request after a restart.
+    std::optional<AdoptedGadgetState> mAdoptedState;
 };
 
 }  // namespace gadget
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.gadget.aidl-service.UsbSpeedMonitor"
+
+#include "UsbSpeedMonitor.h"
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include <cstring>
+#include <utility>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace gadget {
+
+using ::android::base::ReadFileToString;
+using ::android::base::Trim;
+
+#define USB_STATE_MAX_LEN 20
+// Bounds the downgrade history kept for a single data session.
+#define MAX_SPEED_DOWNGRADES 32
+// Interval between attempts to open the udc state while it is not registered.
+#define REOPEN_INTERVAL_MS 2000
+
+constexpr char kNotAttachedState[] = "not attached";
+
+static const std::pair<const char *, UsbSpeed> kUsbSpeeds[] = {
+    {"low-speed", UsbSpeed::LOWSPEED},
+    {"full-speed", UsbSpeed::FULLSPEED},
+    {"high-speed", UsbSpeed::HIGHSPEED},
+    {"super-speed", UsbSpeed::SUPERSPEED},
+    {"super-speed-plus", UsbSpeed::SUPERSPEED_10Gb},
+};
+
+UsbSpeed UsbSpeedMonitor::parseUsbSpeed(const std::string &speed) {
+    for (const auto &[name, usbSpeed] : kUsbSpeeds) {
+        if (speed == name)
+            return usbSpeed;
+    }
+    return UsbSpeed::UNKNOWN;
+}
+
+const char *UsbSpeedMonitor::usbSpeedToString(UsbSpeed speed) {
+    for (const auto &[name, usbSpeed] : kUsbSpeeds) {
+        if (speed == usbSpeed)
+            return name;
+    }
+    return "UNKNOWN";
+}
+
+UsbSpeedMonitor::UsbSpeedMonitor(const std::string &udcStatePath,
+                                 const std::string &udcSpeedPath,
+                                 std::function<void(UsbSpeed)> speedChangedCb,
+                                 std::function<void(const std::string &)> stateChangedCb)
+    : mStarted(false),
+      mMonitoring(false),
+      mStatePath(udcStatePath),
+      mSpeedPath(udcSpeedPath),
+      mUsbSpeed(UsbSpeed::UNKNOWN),
+      mSessionSpeed(UsbSpeed::UNKNOWN),
+      mSpeedChangedCb(speedChangedCb),
+      mStateChangedCb(stateChangedCb) {
+    struct epoll_event ev;
+
+    mEpollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (mEpollFd.get() == -1) {
+        ALOGE("epoll_create failed; errno=%d", errno);
+        abort();
+    }
+
+    mStopFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (mStopFd.get() == -1) {
+        ALOGE("eventfd failed; errno=%d", errno);
+        abort();
+    }
+
+    ev.data.fd = mStopFd.get();
+    ev.events = EPOLLIN;
+    if (epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, mStopFd.get(), &ev) != 0) {
+        ALOGE("epoll_ctl failed; errno=%d", errno);
+        abort();
+    }
+}
+
+UsbSpeedMonitor::~UsbSpeedMonitor() {
+    stop();
+}
+
+void UsbSpeedMonitor::start() {
+    if (mStarted)
+        return;
+
+    /*
+     * The udc might not be registered yet depending on the current data role. The
+     * monitor thread retries, getUsbSpeed() reads current_speed directly meanwhile.
+     */
+    if (!openStateFd()) {
+        ALOGI("Cannot open %s, retrying from the monitor thread", mStatePath.c_str());
+        updateUsbSpeed();
+    }
+
+    if (pthread_create(&mMonitor, NULL, this->monitorThread, this)) {
+        ALOGE("pthread creation failed %d", errno);
+        abort();
+    }
+    mStarted = true;
+}
+
+void UsbSpeedMonitor::stop() {
+    if (!mStarted)
+        return;
+
+    if (eventfd_write(mStopFd.get(), 1))
+        ALOGE("eventfd_write failed; errno=%d", errno);
+    pthread_join(mMonitor, NULL);
+    mStarted = false;
+}
+
+UsbSpeed UsbSpeedMonitor::getUsbSpeed() {
+    if (!mMonitoring)
+        updateUsbSpeed();
+    return mUsbSpeed;
+}
+
+std::vector<UsbSpeedMonitor::SpeedDowngrade> UsbSpeedMonitor::getSpeedDowngrades() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDowngrades;
+}
+
+void UsbSpeedMonitor::updateUsbSpeed() {
+    std::string currentSpeed;
+    UsbSpeed newSpeed = UsbSpeed::UNKNOWN;
+
+    if (ReadFileToString(mSpeedPath, &currentSpeed))
+        newSpeed = parseUsbSpeed(Trim(currentSpeed));
+    else
+        ALOGE("Fail to read current speed");
+
+    UsbSpeed oldSpeed = mUsbSpeed.exchange(newSpeed);
+    if (newSpeed == oldSpeed)
+        return;
+
+    ALOGI("USB speed changes from %s to %s", usbSpeedToString(oldSpeed),
+          usbSpeedToString(newSpeed));
+
+    if (newSpeed != UsbSpeed::UNKNOWN) {
+        if (mSessionSpeed != UsbSpeed::UNKNOWN &&
+            static_cast<int>(newSpeed) < static_cast<int>(mSessionSpeed.load())) {
+            ALOGW("USB speed downgraded from %s to %s", usbSpeedToString(mSessionSpeed.load()),
+                  usbSpeedToString(newSpeed));
+            std::lock_guard<std::mutex> lock(mLock);
+            if (mDowngrades.size() < MAX_SPEED_DOWNGRADES)
+                mDowngrades.push_back({mSessionSpeed, newSpeed, boot_clock::now()});
+        }
+        mSessionSpeed = newSpeed;
+    }
+
+    if (mSpeedChangedCb)
+        mSpeedChangedCb(newSpeed);
+}
+
+bool UsbSpeedMonitor::openStateFd() {
+    struct epoll_event ev;
+
+    unique_fd stateFd(open(mStatePath.c_str(), O_RDONLY | O_CLOEXEC));
+    if (stateFd.get() == -1)
+        return false;
+
+    ev.data.fd = stateFd.get();
+    ev.events = EPOLLPRI;
+    if (epoll_ctl(mEpollFd.get(), EPOLL_CTL_ADD, stateFd.get(), &ev) != 0) {
+        ALOGE("epoll_ctl failed; errno=%d", errno);
+        return false;
+    }
+
+    mStateFd = std::move(stateFd);
+    mMonitoring = true;
+
+    // Read the state once so that sysfs arms the POLLPRI notification.
+    if (!handleStateEvent()) {
+        closeStateFd();
+        return false;
+    }
+    return true;
+}
+
+void UsbSpeedMonitor::closeStateFd() {
+    epoll_ctl(mEpollFd.get(), EPOLL_CTL_DEL, mStateFd.get(), NULL);
+    mStateFd.reset();
+    mMonitoring = false;
+}
+
+bool UsbSpeedMonitor::handleStateEvent() {
+    char state[USB_STATE_MAX_LEN] = {0};
+
+    lseek(mStateFd.get(), 0, SEEK_SET);
+    if (read(mStateFd.get(), &state, USB_STATE_MAX_LEN - 1) <= 0)
+        return false;
+
+    // A new data session starts with the next attach; drop the previous history.
+    if (!strncmp(state, kNotAttachedState, strlen(kNotAttachedState))) {
+        std::lock_guard<std::mutex> lock(mLock);
+        mDowngrades.clear();
+        mSessionSpeed = UsbSpeed::UNKNOWN;
+    }
+
+    updateUsbSpeed();
+
+    if (mStateChangedCb)
+        mStateChangedCb(Trim(state));
+    return true;
+}
+
+void *UsbSpeedMonitor::monitorThread(void *param) {
+    UsbSpeedMonitor *monitor = (UsbSpeedMonitor *)param;
+    struct epoll_event events[4];
+    int nevents = 0;
+
+    while (true) {
+        // Without the state fd, wake up periodically to open it again.
+        nevents = epoll_wait(monitor->mEpollFd.get(), events, 4,
+                             monitor->mMonitoring ? -1 : REOPEN_INTERVAL_MS);
+        if (nevents == -1) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("usb speed epoll_wait failed; errno=%d", errno);
+            break;
+        }
+
+        if (nevents == 0) {
+            if (monitor->openStateFd())
+                ALOGI("Monitoring %s", monitor->mStatePath.c_str());
+            continue;
+        }
+
+        for (int n = 0; n < nevents; ++n) {
+            if (events[n].data.fd == monitor->mStopFd.get())
+                return NULL;
+            // The udc was unregistered, e.g. for a data role swap.
+            if (events[n].data.fd == monitor->mStateFd.get() && !monitor->handleStateEvent()) {
+                ALOGI("Lost %s, retrying", monitor->mStatePath.c_str());
+                monitor->closeStateFd();
+            }
+        }
+    }
+    return NULL;
+}
+
+}  // namespace gadget
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <aidl/android/hardware/usb/gadget/UsbSpeed.h>
+#include <android-base/chrono_utils.h>
+#include <android-base/unique_fd.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace gadget {
+
+using ::aidl::android::hardware::usb::gadget::UsbSpeed;
+using ::android::base::boot_clock;
+using ::android::base::unique_fd;
+
+/*
+ * UsbSpeedMonitor tracks the negotiated speed of the udc. The udc state sysfs is
+ * monitored with epoll (POLLPRI); every state change re-reads current_speed, so the
+ * cached speed follows link renegotiation without the gadget HAL polling sysfs.
+ * Speed downgrades within a data session (e.g. super-speed falling back to high-speed
+ * on a marginal cable) are recorded with their timestamps.
+ *
+ * The udc state sysfs goes away while the udc is unregistered, e.g. in host mode. The
+ * monitor thread then retries opening it until stop() is called.
+ */
+class UsbSpeedMonitor {
+  public:
+    struct SpeedDowngrade {
+        UsbSpeed from;
+        UsbSpeed to;
+        boot_clock::time_point timestamp;
+    };
+
+    /*
+     * udcStatePath: udc state sysfs, monitored by epoll.
+     * udcSpeedPath: udc current_speed sysfs, read on every state change.
+     * speedChangedCb: invoked from the monitor thread when the cached speed changes.
+     * stateChangedCb: invoked from the monitor thread with every udc state read.
+     */
+    UsbSpeedMonitor(const std::string &udcStatePath, const std::string &udcSpeedPath,
+                    std::function<void(UsbSpeed)> speedChangedCb,
+                    std::function<void(const std::string &)> stateChangedCb);
+    ~UsbSpeedMonitor();
+
+    // Starts the monitor thread. The callbacks are invoked from here on.
+    void start();
+    // Stops and joins the monitor thread; no callback runs once this returns.
+    void stop();
+
+    // Returns the last speed read from current_speed.
+    UsbSpeed getUsbSpeed();
+    // Returns the last known speed of the current data session, which survives the
+    // pulldown of a function switch as long as the cable stays attached.
+    UsbSpeed getSessionUsbSpeed() const { return mSessionSpeed; }
+    // Returns the speed downgrades recorded in the current data session.
+    std::vector<SpeedDowngrade> getSpeedDowngrades();
+
+    static UsbSpeed parseUsbSpeed(const std::string &speed);
+    static const char *usbSpeedToString(UsbSpeed speed);
+
+  private:
+    static void *monitorThread(void *param);
+    bool openStateFd();
+    void closeStateFd();
+    bool handleStateEvent();
+    void updateUsbSpeed();
+
+    pthread_t mMonitor;
+    bool mStarted;
+    unique_fd mEpollFd;
+    // Signalled by stop() to end the monitor thread.
+    unique_fd mStopFd;
+    // Owned by the monitor thread once started.
+    unique_fd mStateFd;
+    // Whether mStateFd is open; getUsbSpeed() reads current_speed directly otherwise.
+    std::atomic<bool> mMonitoring;
+    const std::string mStatePath;
+    const std::string mSpeedPath;
+    std::atomic<UsbSpeed> mUsbSpeed;
+    // Last known speed negotiated since the cable was attached.
+    std::atomic<UsbSpeed> mSessionSpeed;
+    // Protects mDowngrades.
+    std::mutex mLock;
+    std::vector<SpeedDowngrade> mDowngrades;
+    std::function<void(UsbSpeed)> mSpeedChangedCb;
+    std::function<void(const std::string &)> mStateChangedCb;
+};
+
+}  // namespace gadget
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
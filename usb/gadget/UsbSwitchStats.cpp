@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.gadget.aidl-service.UsbSwitchStats"
+#define ATRACE_TAG ATRACE_TAG_HAL
+
+#include "UsbSwitchStats.h"
+
+#include <aidl/android/hardware/usb/gadget/GadgetFunction.h>
+#include <utils/Log.h>
+#include <utils/Trace.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace gadget {
+
+using ::aidl::android::hardware::usb::gadget::GadgetFunction;
+
+static const std::pair<long, const char *> kFunctionNames[] = {
+    {GadgetFunction::ADB, "adb"},
+    {GadgetFunction::ACCESSORY, "accessory"},
+    {GadgetFunction::MTP, "mtp"},
+    {GadgetFunction::MIDI, "midi"},
+    {GadgetFunction::PTP, "ptp"},
+    {GadgetFunction::RNDIS, "rndis"},
+    {GadgetFunction::AUDIO_SOURCE, "audio_source"},
+    {GadgetFunction::NCM, "ncm"},
+    {GadgetFunction::UVC, "uvc"},
+};
+
+static std::string functionsToString(long functions) {
+    std::string name;
+
+    for (const auto &[function, functionName] : kFunctionNames) {
+        if ((functions & function) == 0)
+            continue;
+        if (!name.empty())
+            name += "|";
+        name += functionName;
+    }
+    return name.empty() ? "none" : name;
+}
+
+static std::chrono::microseconds toUs(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+const char *UsbSwitchStats::stageName(Stage stage) {
+    switch (stage) {
+        case TEARDOWN:
+            return "teardown";
+        case DISCONNECT_WAIT:
+            return "disconnect_wait";
+        case VID_PID:
+            return "vid_pid";
+        case LINK_FUNCTIONS:
+            return "link_functions";
+        case PULLUP:
+            return "pullup";
+        case ENUMERATION:
+            return "enumeration";
+        case TOTAL:
+            return "total";
+        default:
+            return "unknown";
+    }
+}
+
+UsbSwitchStats::UsbSwitchStats() : mLastFunctions(GadgetFunction::NONE) {}
+
+void UsbSwitchStats::beginSwitch(long functions) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    mCurrentTransition = functionsToString(mLastFunctions) + "->" + functionsToString(functions);
+    mLastFunctions = functions;
+    mSwitchStart = std::chrono::steady_clock::now();
+    mEnumerationStart.reset();
+}
+
+void UsbSwitchStats::setAppliedFunctions(long functions) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mLastFunctions = functions;
+}
+
+void UsbSwitchStats::recordStage(Stage stage, std::chrono::steady_clock::duration duration) {
+    std::lock_guard<std::mutex> lock(mLock);
+    addSampleLocked(stage, toUs(duration));
+}
+
+void UsbSwitchStats::endSwitch() {
+    std::lock_guard<std::mutex> lock(mLock);
+    auto now = std::chrono::steady_clock::now();
+
+    addSampleLocked(TOTAL, toUs(now - mSwitchStart));
+    mEnumerationStart = now;
+}
+
+void UsbSwitchStats::onConfigured() {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (!mEnumerationStart)
+        return;
+    addSampleLocked(ENUMERATION, toUs(std::chrono::steady_clock::now() - *mEnumerationStart));
+    mEnumerationStart.reset();
+}
+
+void UsbSwitchStats::addSampleLocked(Stage stage, std::chrono::microseconds duration) {
+    if (mCurrentTransition.empty())
+        return;
+
+    ALOGV("%s %s: %lldus", mCurrentTransition.c_str(), stageName(stage),
+          (long long)duration.count());
+
+    auto it = mTransitions.find(mCurrentTransition);
+    if (it == mTransitions.end())
+        it = mTransitions.emplace(mCurrentTransition, TransitionStats{}).first;
+    it->second[stage].add(duration);
+}
+
+void UsbSwitchStats::dump(int fd) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    dprintf(fd, "Function switch latency (last %d samples per stage, %s)\n",
+            StageWindow::kWindowSize, StageWindow::bucketLegend());
+    for (const auto &[transition, stats] : mTransitions) {
+        dprintf(fd, "  %s\n", transition.c_str());
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+            stats[stage].dump(fd, "    ", stageName((Stage)stage));
+    }
+}
+
+ScopedSwitchStage::ScopedSwitchStage(UsbSwitchStats *stats, UsbSwitchStats::Stage stage)
+    : mStats(stats), mStage(stage), mTimer(ATRACE_TAG, UsbSwitchStats::stageName(stage)) {}
+
+ScopedSwitchStage::~ScopedSwitchStage() {
+    mStats->recordStage(mStage, mTimer.elapsed());
+}
+
+}  // namespace gadget
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
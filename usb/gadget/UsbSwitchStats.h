@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <StageStats.h>
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+namespace gadget {
+
+/*
+ * UsbSwitchStats keeps a rolling StageWindow for each stage of a gadget function
+ * switch, grouped by transition (e.g. none->mtp, adb->adb|ncm). Each stage is also
+ * emitted as an atrace span. The windows are printed by dump().
+ */
+class UsbSwitchStats {
+  public:
+    enum Stage {
+        TEARDOWN = 0,
+        DISCONNECT_WAIT,
+        VID_PID,
+        LINK_FUNCTIONS,
+        // Waiting for the ffs descriptors and pulling up the gadget.
+        PULLUP,
+        // From pullup until the host configures the gadget.
+        ENUMERATION,
+        TOTAL,
+        STAGE_COUNT,
+    };
+
+    UsbSwitchStats();
+
+    // Starts accounting for a switch from the last applied functions to |functions|.
+    void beginSwitch(long functions);
+    // Sets the functions the next switch starts from, e.g. ones adopted from configfs.
+    void setAppliedFunctions(long functions);
+    void recordStage(Stage stage, std::chrono::steady_clock::duration duration);
+    // Records the total time of the current switch and waits for the host to enumerate.
+    void endSwitch();
+    // Called when the udc reaches the configured state.
+    void onConfigured();
+    void dump(int fd);
+
+    static const char *stageName(Stage stage);
+
+  private:
+    using StageWindow = ::android::hardware::google::gs201::StageWindow;
+    using TransitionStats = std::array<StageWindow, STAGE_COUNT>;
+
+    void addSampleLocked(Stage stage, std::chrono::microseconds duration);
+
+    std::mutex mLock;
+    std::map<std::string, TransitionStats> mTransitions;
+    std::string mCurrentTransition;
+    std::chrono::steady_clock::time_point mSwitchStart;
+    std::optional<std::chrono::steady_clock::time_point> mEnumerationStart;
+    long mLastFunctions;
+};
+
+/*
+ * Times a stage of the current switch and emits it as an atrace span for the lifetime
+ * of the object.
+ */
+class ScopedSwitchStage {
+  public:
+    ScopedSwitchStage(UsbSwitchStats *stats, UsbSwitchStats::Stage stage);
+    ~ScopedSwitchStage();
+
+  private:
+    UsbSwitchStats *mStats;
+    UsbSwitchStats::Stage mStage;
+    ::android::hardware::google::gs201::ScopedStageTimer mTimer;
+};
+
+}  // namespace gadget
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl